@@ -7,6 +7,48 @@
 #include <cstdio>
 #include <ctime>
 #include <limits>
+#include <climits>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <queue>
+#include <set>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <atomic>
+#include <shared_mutex>
+#include <deque>
+#include <optional>
+#include <charconv>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <cstring>
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
 
 using namespace std;
 
@@ -46,6 +88,50 @@ void clearInputBuffer()
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 }
 
+// Tags are lower case and limited to letters, digits and "-_./:" so a set
+// of them fits in one CSV field, separated by ';'.
+string normalizeTag(const string& tag)
+{
+    string out;
+    for (char c : tag)
+    {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (isalnum(u) || string("-_./:").find(c) != string::npos) out += static_cast<char>(tolower(u));
+    }
+    return out;
+}
+
+// Splits on commas, semicolons and spaces; the result is sorted and unique.
+vector<string> parseTagList(const string& text)
+{
+    vector<string> tags;
+    string current;
+    for (size_t i = 0; i <= text.size(); ++i)
+    {
+        if (i == text.size() || text[i] == ',' || text[i] == ';' || isspace(static_cast<unsigned char>(text[i])))
+        {
+            string tag = normalizeTag(current);
+            if (!tag.empty()) tags.push_back(tag);
+            current.clear();
+        }
+        else current += text[i];
+    }
+    sort(tags.begin(), tags.end());
+    tags.erase(unique(tags.begin(), tags.end()), tags.end());
+    return tags;
+}
+
+string joinTags(const vector<string>& tags)
+{
+    string out;
+    for (const auto& t : tags)
+    {
+        if (!out.empty()) out += ';';
+        out += t;
+    }
+    return out;
+}
+
 class Time
 {
 private:
@@ -97,10 +183,19 @@ public:
     {
         year = (y >= 1900 && y <= 9999) ? y : 2000;
         month = (m >= 1 && m <= 12) ? m : 1;
-        int maxDay = 31;
-        if (m == 2) maxDay = 28;
-        else if (m == 4 || m == 6 || m == 9 || m == 11) maxDay = 30;
-        day = (d >= 1 && d <= maxDay) ? d : 1;
+        day = (d >= 1 && d <= daysInMonth(year, month)) ? d : 1;
+    }
+
+    static bool isLeapYear(int y)
+    {
+        return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    }
+
+    static int daysInMonth(int y, int m)
+    {
+        if (m == 2) return isLeapYear(y) ? 29 : 28;
+        if (m == 4 || m == 6 || m == 9 || m == 11) return 30;
+        return 31;
     }
 
     int getYear() const
@@ -123,6 +218,52 @@ public:
         return time;
     }
 
+    // Days since 1970-01-01 on the proleptic Gregorian calendar.
+    long long toDayNumber() const
+    {
+        long long y = year - (month <= 2 ? 1 : 0);
+        long long era = (y >= 0 ? y : y - 399) / 400;
+        long long yoe = y - era * 400;
+        long long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    long long toTimestamp() const
+    {
+        return toDayNumber() * 86400 + time.getHour() * 3600 + time.getMinute() * 60 + time.getSecond();
+    }
+
+    static Date fromDayNumber(long long z, Time t = Time())
+    {
+        z += 719468;
+        long long era = (z >= 0 ? z : z - 146096) / 146097;
+        long long doe = z - era * 146097;
+        long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        long long mp = (5 * doy + 2) / 153;
+        int d = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+        int m = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+        int y = static_cast<int>(yoe + era * 400 + (m <= 2 ? 1 : 0));
+        return Date(y, m, d, t);
+    }
+
+    static Date fromTimestamp(long long ts)
+    {
+        long long dayNum = ts >= 0 ? ts / 86400 : -((-ts + 86399) / 86400);
+        long long secs = ts - dayNum * 86400;
+        return fromDayNumber(dayNum, Time(static_cast<int>(secs / 3600),
+                                          static_cast<int>((secs % 3600) / 60),
+                                          static_cast<int>(secs % 60)));
+    }
+
+    // 0 = Monday ... 6 = Sunday
+    int getWeekday() const
+    {
+        long long w = (toDayNumber() + 3) % 7;
+        return static_cast<int>(w < 0 ? w + 7 : w);
+    }
+
     string toString() const
     {
         char buf[20];
@@ -160,7 +301,13 @@ public:
 Date getCurrentDate()
 {
     time_t now = time(0);
-    tm *ltm = localtime(&now);
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    tm *ltm = &local;
     return Date(
                1900 + ltm->tm_year,
                1 + ltm->tm_mon,
@@ -169,11 +316,68 @@ Date getCurrentDate()
            );
 }
 
+// Currency codes are interned so each transaction carries a two-byte id;
+// id 0 is the ledger's own (base) currency.
+class Currency
+{
+private:
+    static vector<string>& codes()
+    {
+        static vector<string> table(1);
+        return table;
+    }
+
+public:
+    // Three letters, upper-cased; empty for anything else.
+    static string normalize(const string& text)
+    {
+        string code;
+        for (char c : text)
+        {
+            if (isspace(static_cast<unsigned char>(c))) continue;
+            if (!isalpha(static_cast<unsigned char>(c))) return "";
+            code += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        }
+        return code.size() == 3 ? code : "";
+    }
+
+    static uint16_t intern(const string& text)
+    {
+        string code = normalize(text);
+        if (code.empty()) return 0;
+        vector<string>& table = codes();
+        for (size_t i = 1; i < table.size(); ++i)
+            if (table[i] == code) return static_cast<uint16_t>(i);
+        table.push_back(code);
+        return static_cast<uint16_t>(table.size() - 1);
+    }
+
+    static const string& code(uint16_t id)
+    {
+        return codes()[id];
+    }
+
+    static size_t count()
+    {
+        return codes().size();
+    }
+};
+
+// Optional fields after a record's date: "tag;tag[,CUR]".
+void parseRecordExtras(const string& text, vector<string>& tags, uint16_t& currency)
+{
+    size_t comma = text.find(',');
+    tags = parseTagList(text.substr(0, comma));
+    currency = comma == string::npos ? 0 : Currency::intern(text.substr(comma + 1));
+}
+
 class Transaction
 {
 private:
     double amount;
     Date date;
+    vector<string> tags;
+    uint16_t currency = 0;
 
 public:
     Transaction(double amn, Date dt) : amount(amn), date(dt) {}
@@ -185,7 +389,7 @@ public:
         return amount;
     }
 
-    Date getDate() const
+    const Date& getDate() const
     {
         return date;
     }
@@ -200,6 +404,44 @@ public:
         date = dt;
     }
 
+    const vector<string>& getTags() const
+    {
+        return tags;
+    }
+
+    void setTags(vector<string> t)
+    {
+        sort(t.begin(), t.end());
+        t.erase(unique(t.begin(), t.end()), t.end());
+        tags = t;
+    }
+
+    bool hasTag(const string& tag) const
+    {
+        return binary_search(tags.begin(), tags.end(), tag);
+    }
+
+    string tagSuffix() const
+    {
+        return tags.empty() ? "" : " ,Tags: " + joinTags(tags);
+    }
+
+    // Currency id (see Currency); 0 is the base currency.
+    uint16_t getCurrency() const
+    {
+        return currency;
+    }
+
+    void setCurrency(uint16_t id)
+    {
+        currency = id;
+    }
+
+    string currencySuffix() const
+    {
+        return currency == 0 ? "" : " " + Currency::code(currency);
+    }
+
     virtual void viewTrans() const = 0;
 };
 
@@ -216,14 +458,14 @@ public:
         source = src;
     }
 
-    string getSource() const
+    const string& getSource() const
     {
         return source;
     }
 
     void viewTrans() const override
     {
-        cout << "Source: " << getSource() << " ,Amount: " << getAmount() << " ,Date: " << getDate().toString() << endl;
+        cout << "Source: " << getSource() << " ,Amount: " << getAmount() << currencySuffix() << " ,Date: " << getDate().toString() << tagSuffix() << endl;
     }
 };
 
@@ -240,650 +482,8091 @@ public:
         category = cat;
     }
 
-    string getCategory() const
+    const string& getCategory() const
     {
         return category;
     }
 
     void viewTrans() const override
     {
-        cout << "Category: " << getCategory() << " ,Amount: " << getAmount() << " ,Date: " << getDate().toString() << endl;
+        cout << "Category: " << getCategory() << " ,Amount: " << getAmount() << currencySuffix() << " ,Date: " << getDate().toString() << tagSuffix() << endl;
     }
 };
 
-class Budget
+struct FilterRow
 {
-private:
-    string category;
+    bool isIncome;
     double amount;
+    const string* label;
+    const Date* date;
+    mutable long long timestamp;
+    mutable bool hasTimestamp;
 
-public:
-    Budget(string cat, double amt) : category(cat), amount(amt) {}
-
-    void setCategory(string cat)
+    long long getTimestamp() const
     {
-        category = cat;
+        if (!hasTimestamp)
+        {
+            timestamp = date->toTimestamp();
+            hasTimestamp = true;
+        }
+        return timestamp;
     }
+};
 
-    string getCategory() const
+// Small filter language compiled to a short-circuiting predicate program:
+//   expense AND category IN (food, rent) AND amount >= 50 AND date <= 2026-03-31
+//   income OR NOT (source = salary OR amount < 10)
+// The expression is specialised separately for incomes and expenses, so
+// type tests and category/source sets fold to constants before any row is read.
+class TransactionFilter
+{
+private:
+    enum class NodeKind { AMOUNT_RANGE, TIME_RANGE, LABEL_IN, IS_INCOME, CONSTANT, AND, OR, NOT };
+    enum class Cmp { LT, LE, GT, GE, EQ, NE };
+    enum class InstrKind { TEST, JUMP_IF_FALSE, JUMP_IF_TRUE, NOT };
+
+    struct Node
     {
-        return category;
-    }
+        NodeKind kind = NodeKind::CONSTANT;
+        double low = -numeric_limits<double>::infinity();
+        double high = numeric_limits<double>::infinity();
+        bool lowOpen = false;
+        bool highOpen = false;
+        long long from = LLONG_MIN;
+        long long to = LLONG_MAX;
+        bool incomeLabel = false;
+        bool constant = true;
+        unordered_set<string> labels;
+        vector<Node> children;
+    };
 
-    double getAmount() const
+    struct Instr
     {
-        return amount;
-    }
+        InstrKind kind;
+        size_t arg;
+    };
 
-    void setAmount(double amt)
+    struct Program
     {
-        amount = amt;
+        vector<Node> leaves;
+        vector<Instr> code;
+        bool isConstant = true;
+        bool constantValue = false;
+    };
+
+    vector<string> tokens;
+    size_t pos = 0;
+    Program programs[2];
+    long long fromBound = LLONG_MIN;
+    long long toBound = LLONG_MAX;
+
+    static string lower(string s)
+    {
+        for (auto& c : s) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return s;
     }
-};
 
-class FinanceTracker
-{
-private:
-    vector<Income> incomes;
-    vector<Expense> expenses;
-    vector<Budget> budgets;
+    void tokenize(const string& text)
+    {
+        size_t i = 0;
+        while (i < text.size())
+        {
+            char c = text[i];
+            if (isspace(static_cast<unsigned char>(c)))
+            {
+                ++i;
+            }
+            else if (c == '(' || c == ')' || c == ',')
+            {
+                tokens.push_back(string(1, c));
+                ++i;
+            }
+            else if (c == '<' || c == '>' || c == '=' || c == '!')
+            {
+                string op(1, c);
+                if (i + 1 < text.size() && text[i + 1] == '=') op += '=';
+                tokens.push_back(op);
+                i += op.size();
+            }
+            else if (c == '"' || c == '\'')
+            {
+                size_t close = text.find(c, i + 1);
+                if (close == string::npos) throw runtime_error("unterminated quote");
+                tokens.push_back("\x01" + text.substr(i + 1, close - i - 1));
+                i = close + 1;
+            }
+            else
+            {
+                size_t start = i;
+                while (i < text.size() && !isspace(static_cast<unsigned char>(text[i])) &&
+                        string("(),<>=!").find(text[i]) == string::npos) ++i;
+                tokens.push_back(text.substr(start, i - start));
+            }
+        }
+    }
 
-    double calculateTotalIncome() const
+    bool atEnd() const
     {
-        double totalIncome = 0;
-        for (const auto& inc : incomes) totalIncome += inc.getAmount();
-        return totalIncome;
+        return pos >= tokens.size();
     }
 
-    double calculateTotalExpenses() const
+    string peekKeyword() const
     {
-        double totalExpenses = 0;
-        for (const auto& exp : expenses) totalExpenses += exp.getAmount();
-        return totalExpenses;
+        return atEnd() ? "" : lower(tokens[pos]);
     }
 
-    double calculateSpentInCategory(string category) const
+    string next(const string& what)
     {
-        double totalExpenses = 0;
-        for (const auto& exp : expenses)
-        {
-            if (exp.getCategory() == category) totalExpenses += exp.getAmount();
-        }
-        return totalExpenses;
+        if (atEnd()) throw runtime_error("expected " + what + " at end of filter");
+        return tokens[pos++];
     }
 
-    double getBudgetOfCategory(string category) const
+    void expect(const string& tok)
     {
-        for (const auto& b : budgets)
-        {
-            if (b.getCategory() == category) return b.getAmount();
-        }
-        return 0;
+        string got = next("'" + tok + "'");
+        if (got != tok) throw runtime_error("expected '" + tok + "' but found '" + got + "'");
     }
 
-public:
-    FinanceTracker()
+    static string value(const string& tok)
     {
-        loadFromFile("finance_data.csv");
+        return (!tok.empty() && tok[0] == '\x01') ? tok.substr(1) : tok;
     }
 
-    ~FinanceTracker()
+    Cmp parseCmp()
     {
-        saveToFile("finance_data.csv");
+        string op = next("comparison");
+        if (op == "<") return Cmp::LT;
+        if (op == "<=") return Cmp::LE;
+        if (op == ">") return Cmp::GT;
+        if (op == ">=") return Cmp::GE;
+        if (op == "=" || op == "==") return Cmp::EQ;
+        if (op == "!=") return Cmp::NE;
+        throw runtime_error("unknown comparison '" + op + "'");
     }
 
-    void addIncome(double amt, Date dt, string src)
+    static Node makeConstant(bool v)
     {
-        if (amt < 0)
-        {
-            cout << "Error: Negative amount!\n";
-            return;
-        }
-        if (src.empty())
-        {
-            cout << "Error: Source cannot be empty!\n";
-            return;
-        }
-        if (amt > 10000) cout << "Alert: Large income added (" << amt << ")!\n";
-        incomes.push_back(Income(src, amt, dt));
-        cout << "Income added successfully!\n";
+        Node n;
+        n.kind = NodeKind::CONSTANT;
+        n.constant = v;
+        return n;
     }
 
-    void viewIncomes() const
+    static Node makeNot(Node child)
     {
-        if (incomes.empty())
-        {
-            cout << "No incomes.\n";
-            return;
-        }
-        cout << "\n=== All Incomes ===\n";
-        for (size_t i = 0; i < incomes.size(); ++i)
-        {
-            cout << i << ": ";
-            incomes[i].viewTrans();
-        }
+        Node n;
+        n.kind = NodeKind::NOT;
+        n.children.push_back(move(child));
+        return n;
     }
 
-    void updateIncome(int index, double amt, Date dt, string src)
+    Node parseDate()
     {
-        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        Cmp cmp = parseCmp();
+        string text = value(next("date"));
+        int y = 0, m = 0, d = 0, h = -1, mi = 0, sec = 0;
+        int fields = sscanf(text.c_str(), "%d-%d-%dT%d:%d:%d", &y, &m, &d, &h, &mi, &sec);
+        // The Date constructor would quietly clamp a bad day or time, so check them here.
+        if ((fields != 3 && fields != 6) || y < 1900 || y > 9999 || m < 1 || m > 12 || d < 1 || d > Date::daysInMonth(y, m) ||
+                (fields == 6 && (h < 0 || h > 23 || mi < 0 || mi > 59 || sec < 0 || sec > 59)))
+            throw runtime_error("invalid date '" + text + "' (use YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS)");
+
+        long long lo, hi;
+        if (h < 0)
         {
-            cout << "Invalid index!\n";
-            return;
+            lo = Date(y, m, d).toTimestamp();
+            hi = lo + 86399;
         }
-        if (amt < 0)
+        else
         {
-            cout << "Error: Negative amount!\n";
-            return;
+            lo = hi = Date(y, m, d, Time(h, mi, sec)).toTimestamp();
         }
-        if (src.empty())
+
+        Node n;
+        n.kind = NodeKind::TIME_RANGE;
+        if (cmp == Cmp::LT) n.to = lo - 1;
+        else if (cmp == Cmp::LE) n.to = hi;
+        else if (cmp == Cmp::GT) n.from = hi + 1;
+        else if (cmp == Cmp::GE) n.from = lo;
+        else
         {
-            cout << "Error: Source cannot be empty!\n";
-            return;
+            n.from = lo;
+            n.to = hi;
         }
-        incomes[index].setAmount(amt);
-        incomes[index].setDate(dt);
-        incomes[index].setSource(src);
-        cout << "Income updated successfully!\n";
+        return cmp == Cmp::NE ? makeNot(n) : n;
     }
 
-    void updateIncome(int index, int updateChoice, double amt, string src, Date dt)
+    Node parseLabel(bool incomeLabel)
     {
-        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        Node n;
+        n.kind = NodeKind::LABEL_IN;
+        n.incomeLabel = incomeLabel;
+        string op = next("'IN', '=' or '!='");
+        if (lower(op) == "in")
         {
-            cout << "Invalid index!\n";
-            return;
+            expect("(");
+            while (true)
+            {
+                n.labels.insert(value(next("value")));
+                string sep = next("',' or ')'");
+                if (sep == ")") break;
+                if (sep != ",") throw runtime_error("expected ',' or ')' but found '" + sep + "'");
+            }
+            return n;
         }
+        if (op != "=" && op != "==" && op != "!=") throw runtime_error("expected 'IN', '=' or '!=' after field");
+        n.labels.insert(value(next("value")));
+        return op == "!=" ? makeNot(n) : n;
+    }
 
-        if (updateChoice == 1)
+    Node parsePrimary()
+    {
+        string tok = next("condition");
+        string kw = lower(tok);
+        if (tok == "(")
         {
-            if (amt < 0)
-            {
-                cout << "Error: Negative amount!\n";
-                return;
-            }
-            incomes[index].setAmount(amt);
+            Node n = parseOr();
+            expect(")");
+            return n;
         }
-        else if (updateChoice == 2)
+        if (kw == "income" || kw == "incomes" || kw == "expense" || kw == "expenses")
         {
-            if (src.empty())
-            {
-                cout << "Error: Source cannot be empty!\n";
-                return;
-            }
-            incomes[index].setSource(src);
+            Node n;
+            n.kind = NodeKind::IS_INCOME;
+            return kw[0] == 'i' ? n : makeNot(n);
         }
-        else if (updateChoice == 3)
+        if (kw == "type")
         {
-            incomes[index].setDate(dt);
+            string op = next("'=' or '!='");
+            string t = lower(value(next("income or expense")));
+            if ((op != "=" && op != "==" && op != "!=") || (t != "income" && t != "expense"))
+                throw runtime_error("type must be compared with income or expense");
+            Node n;
+            n.kind = NodeKind::IS_INCOME;
+            bool wantIncome = (t == "income") != (op == "!=");
+            return wantIncome ? n : makeNot(n);
         }
-        else if (updateChoice == 4)
+        if (kw == "amount")
         {
-            if (amt < 0)
+            Node n;
+            n.kind = NodeKind::AMOUNT_RANGE;
+            Cmp cmp = parseCmp();
+            string num = value(next("amount"));
+            if (!isValidDouble(num)) throw runtime_error("invalid amount '" + num + "'");
+            double v = stod(num);
+            if (cmp == Cmp::LT || cmp == Cmp::LE || cmp == Cmp::EQ || cmp == Cmp::NE)
             {
-                cout << "Error: Negative amount!\n";
-                return;
+                n.high = v;
+                n.highOpen = cmp == Cmp::LT;
             }
-            if (src.empty())
+            if (cmp == Cmp::GT || cmp == Cmp::GE || cmp == Cmp::EQ || cmp == Cmp::NE)
             {
-                cout << "Error: Source cannot be empty!\n";
-                return;
+                n.low = v;
+                n.lowOpen = cmp == Cmp::GT;
             }
-            incomes[index].setAmount(amt);
-            incomes[index].setSource(src);
-            incomes[index].setDate(dt);
+            return cmp == Cmp::NE ? makeNot(n) : n;
         }
-        cout << "Income updated successfully!\n";
+        if (kw == "category") return parseLabel(false);
+        if (kw == "source") return parseLabel(true);
+        if (kw == "date") return parseDate();
+        throw runtime_error("unknown field '" + tok + "'");
     }
 
-    void deleteIncome(int index)
+    Node parseNot()
     {
-        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        if (peekKeyword() == "not")
         {
-            cout << "Invalid index!\n";
-            return;
+            ++pos;
+            return makeNot(parseNot());
         }
-        incomes.erase(incomes.begin() + index);
-        cout << "Income deleted successfully!\n";
+        return parsePrimary();
     }
 
-    void addExpense(double amt, Date dt, string cat)
+    Node parseBinary(NodeKind kind)
     {
-        if (amt < 0)
+        bool isAnd = kind == NodeKind::AND;
+        Node first = isAnd ? parseNot() : parseBinary(NodeKind::AND);
+        if (peekKeyword() != (isAnd ? "and" : "or")) return first;
+        Node n;
+        n.kind = kind;
+        n.children.push_back(move(first));
+        while (peekKeyword() == (isAnd ? "and" : "or"))
         {
-            cout << "Error: Negative amount!\n";
-            return;
+            ++pos;
+            n.children.push_back(isAnd ? parseNot() : parseBinary(NodeKind::AND));
         }
-        if (cat.empty())
+        return n;
+    }
+
+    Node parseOr()
+    {
+        return parseBinary(NodeKind::OR);
+    }
+
+    // Widest time span any matching row can have (empty when from > to).
+    static void bounds(const Node& n, long long& from, long long& to)
+    {
+        from = LLONG_MIN;
+        to = LLONG_MAX;
+        if (n.kind == NodeKind::TIME_RANGE)
         {
-            cout << "Error: Category cannot be empty!\n";
-            return;
+            from = n.from;
+            to = n.to;
         }
-
-        double currentBalance = calculateTotalIncome() - calculateTotalExpenses();
-        if (amt > currentBalance)
+        else if (n.kind == NodeKind::CONSTANT && !n.constant)
         {
-            cout << "\n*** Warning: The current balance ("<< currentBalance
-                 << ") is not enough for this expense ("<< amt << ") ***\n";
-
-            cout << "Do you still want to continue? (y/n): ";
-
-            char confirm;
-
-            cin >> confirm;
-
-            clearInputBuffer();
-
-            if (confirm != 'y' && confirm != 'Y')
-
+            from = LLONG_MAX;
+            to = LLONG_MIN;
+        }
+        else if (n.kind == NodeKind::AND || n.kind == NodeKind::OR)
+        {
+            bool isAnd = n.kind == NodeKind::AND;
+            if (!isAnd)
             {
-                cout << "Expense canceled.\n";
-
-                return;
-
+                from = LLONG_MAX;
+                to = LLONG_MIN;
+            }
+            for (const auto& c : n.children)
+            {
+                long long f, t;
+                bounds(c, f, t);
+                from = isAnd ? max(from, f) : min(from, f);
+                to = isAnd ? min(to, t) : max(to, t);
             }
         }
-
-        if (amt > 10000) cout << "Alert: Large expense added (" << amt << ")!\n";
-        expenses.push_back(Expense(cat, amt, dt));
-        cout << "Expense added successfully!\n";
-        checkBudgets();
     }
 
-    void viewExpenses() const
+    static int cost(const Node& n)
     {
-        if (expenses.empty())
-        {
-            cout << "No expenses.\n";
-            return;
-        }
-        cout << "\n=== All Expenses ===\n";
-        for (size_t i = 0; i < expenses.size(); ++i)
-        {
-            cout << i << ": ";
-            expenses[i].viewTrans();
-        }
+        if (n.kind == NodeKind::AMOUNT_RANGE) return 0;
+        if (n.kind == NodeKind::TIME_RANGE) return 1;
+        if (n.kind == NodeKind::LABEL_IN) return 2;
+        return 3;
     }
 
-    void updateExpense(int index, double amt, Date dt, string cat)
+    // Intersects sibling amount and date ranges under an AND into one leaf each.
+    static void mergeRanges(vector<Node>& children)
     {
-        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        int amountAt = -1;
+        int timeAt = -1;
+        vector<Node> kept;
+        for (auto& c : children)
         {
-            cout << "Invalid index!\n";
-            return;
-        }
-        if (amt < 0)
-        {
-            cout << "Error: Negative amount!\n";
-            return;
-        }
-        if (cat.empty())
-        {
-            cout << "Error: Category cannot be empty!\n";
-            return;
+            if (c.kind == NodeKind::AMOUNT_RANGE && amountAt >= 0)
+            {
+                Node& a = kept[amountAt];
+                if (c.low > a.low || (c.low == a.low && c.lowOpen))
+                {
+                    a.low = c.low;
+                    a.lowOpen = c.lowOpen;
+                }
+                if (c.high < a.high || (c.high == a.high && c.highOpen))
+                {
+                    a.high = c.high;
+                    a.highOpen = c.highOpen;
+                }
+                continue;
+            }
+            if (c.kind == NodeKind::TIME_RANGE && timeAt >= 0)
+            {
+                kept[timeAt].from = max(kept[timeAt].from, c.from);
+                kept[timeAt].to = min(kept[timeAt].to, c.to);
+                continue;
+            }
+            if (c.kind == NodeKind::AMOUNT_RANGE) amountAt = static_cast<int>(kept.size());
+            if (c.kind == NodeKind::TIME_RANGE) timeAt = static_cast<int>(kept.size());
+            kept.push_back(move(c));
         }
-        expenses[index].setAmount(amt);
-        expenses[index].setDate(dt);
-        expenses[index].setCategory(cat);
-        cout << "Expense updated successfully!\n";
+        children.swap(kept);
     }
 
-    void updateExpense(int index, int updateChoice, double amt, string cat, Date dt)
+    // Folds everything that is known from the row type alone.
+    static Node specialise(const Node& n, bool isIncome)
     {
-        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        if (n.kind == NodeKind::IS_INCOME) return makeConstant(isIncome);
+        if (n.kind == NodeKind::LABEL_IN && n.incomeLabel != isIncome) return makeConstant(false);
+        if (n.kind == NodeKind::NOT)
         {
-            cout << "Invalid index!\n";
-            return;
+            Node child = specialise(n.children[0], isIncome);
+            if (child.kind == NodeKind::CONSTANT) return makeConstant(!child.constant);
+            if (child.kind == NodeKind::NOT) return child.children[0];
+            return makeNot(move(child));
         }
-
-        if (updateChoice == 1)
+        if (n.kind == NodeKind::AND || n.kind == NodeKind::OR)
         {
-            if (amt < 0)
+            bool isAnd = n.kind == NodeKind::AND;
+            Node out;
+            out.kind = n.kind;
+            for (const auto& c : n.children)
             {
-                cout << "Error: Negative amount!\n";
-                return;
+                Node s = specialise(c, isIncome);
+                if (s.kind == NodeKind::CONSTANT)
+                {
+                    if (s.constant != isAnd) return makeConstant(s.constant);
+                    continue;
+                }
+                if (s.kind == n.kind)
+                {
+                    for (auto& g : s.children) out.children.push_back(move(g));
+                }
+                else
+                {
+                    out.children.push_back(move(s));
+                }
             }
-            expenses[index].setAmount(amt);
+            if (isAnd) mergeRanges(out.children);
+            if (out.children.empty()) return makeConstant(isAnd);
+            if (out.children.size() == 1) return out.children[0];
+            stable_sort(out.children.begin(), out.children.end(),
+                        [](const Node& a, const Node& b) { return cost(a) < cost(b); });
+            return out;
         }
-        else if (updateChoice == 2)
+        return n;
+    }
+
+    static void emit(const Node& n, Program& p)
+    {
+        if (n.kind == NodeKind::AND || n.kind == NodeKind::OR)
         {
-            if (cat.empty())
+            InstrKind jump = n.kind == NodeKind::AND ? InstrKind::JUMP_IF_FALSE : InstrKind::JUMP_IF_TRUE;
+            vector<size_t> patches;
+            for (size_t i = 0; i < n.children.size(); ++i)
             {
-                cout << "Error: Category cannot be empty!\n";
-                return;
+                emit(n.children[i], p);
+                if (i + 1 < n.children.size())
+                {
+                    patches.push_back(p.code.size());
+                    p.code.push_back({jump, 0});
+                }
             }
-            expenses[index].setCategory(cat);
+            for (size_t at : patches) p.code[at].arg = p.code.size();
         }
-        else if (updateChoice == 3)
+        else if (n.kind == NodeKind::NOT)
         {
-            expenses[index].setDate(dt);
+            emit(n.children[0], p);
+            p.code.push_back({InstrKind::NOT, 0});
         }
-        else if (updateChoice == 4)
+        else
+        {
+            p.code.push_back({InstrKind::TEST, p.leaves.size()});
+            p.leaves.push_back(n);
+        }
+    }
+
+    static bool test(const Node& leaf, const FilterRow& row)
+    {
+        switch (leaf.kind)
+        {
+        case NodeKind::AMOUNT_RANGE:
+            return (leaf.lowOpen ? row.amount > leaf.low : row.amount >= leaf.low) &&
+                   (leaf.highOpen ? row.amount < leaf.high : row.amount <= leaf.high);
+        case NodeKind::TIME_RANGE:
+            return row.getTimestamp() >= leaf.from && row.getTimestamp() <= leaf.to;
+        case NodeKind::LABEL_IN:
+            return leaf.labels.count(*row.label) > 0;
+        default:
+            return leaf.constant;
+        }
+    }
+
+public:
+    // Throws runtime_error with a readable message when the expression is malformed.
+    explicit TransactionFilter(const string& expression)
+    {
+        tokenize(expression);
+        if (tokens.empty()) throw runtime_error("empty filter");
+        Node root = parseOr();
+        if (!atEnd()) throw runtime_error("unexpected '" + value(tokens[pos]) + "'");
+        bounds(root, fromBound, toBound);
+
+        for (int t = 0; t < 2; ++t)
         {
-            if (amt < 0)
+            Node s = specialise(root, t == 1);
+            Program& p = programs[t];
+            if (s.kind == NodeKind::CONSTANT)
             {
-                cout << "Error: Negative amount!\n";
-                return;
+                p.isConstant = true;
+                p.constantValue = s.constant;
             }
-            if (cat.empty())
+            else
             {
-                cout << "Error: Category cannot be empty!\n";
-                return;
+                p.isConstant = false;
+                emit(s, p);
             }
-            expenses[index].setAmount(amt);
-            expenses[index].setCategory(cat);
-            expenses[index].setDate(dt);
         }
-        cout << "Expense updated successfully!\n";
     }
 
-    void deleteExpense(int index)
+    // Rows outside [from, to] never match, so archived years there can be skipped.
+    void timeBounds(long long& from, long long& to) const
     {
-        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        from = fromBound;
+        to = toBound;
+    }
+
+    bool matchesNothing(bool isIncome) const
+    {
+        const Program& p = programs[isIncome ? 1 : 0];
+        return p.isConstant && !p.constantValue;
+    }
+
+    bool matches(const FilterRow& row) const
+    {
+        const Program& p = programs[row.isIncome ? 1 : 0];
+        if (p.isConstant) return p.constantValue;
+        bool acc = false;
+        for (size_t pc = 0; pc < p.code.size(); ++pc)
         {
-            cout << "Invalid index!\n";
-            return;
+            const Instr& in = p.code[pc];
+            switch (in.kind)
+            {
+            case InstrKind::TEST:
+                acc = test(p.leaves[in.arg], row);
+                break;
+            case InstrKind::JUMP_IF_FALSE:
+                if (!acc) pc = in.arg - 1;
+                break;
+            case InstrKind::JUMP_IF_TRUE:
+                if (acc) pc = in.arg - 1;
+                break;
+            case InstrKind::NOT:
+                acc = !acc;
+                break;
+            }
         }
-        expenses.erase(expenses.begin() + index);
-        cout << "Expense deleted successfully!\n";
+        return acc;
     }
+};
+
+enum class SortKey
+{
+    AMOUNT,
+    DATE,
+    LABEL
+};
+
+// A transaction that has no slot in the hot vectors: a row of an archived
+// year or a mapped ledger, or an occurrence of a recurring rule.
+struct DetachedRow
+{
+    string label;
+    double amount;
+    long long ts;
+    string tags;
+    bool recurring;
+};
+
+struct FilterScanResult
+{
+    size_t incomeCount = 0;
+    size_t expenseCount = 0;
+    double incomeSum = 0;
+    double expenseSum = 0;
+    vector<size_t> incomeRows;
+    vector<size_t> expenseRows;
+    size_t archivedCount = 0;
+    size_t recurringCount = 0;
+    vector<DetachedRow> archivedIncomes;
+    vector<DetachedRow> archivedExpenses;
+};
+
+// Compressed set of row positions in the style of Roaring bitmaps. Positions
+// are grouped by their high 16 bits; each group is a sorted array of low
+// halves while it holds at most 4096 of them and a 65536-bit bitset beyond
+// that, so sparse and dense tags both stay small and set operations work
+// a container (or a 64-bit word) at a time.
+class RoaringBitmap
+{
+private:
+    static const uint32_t arrayMax = 4096;
+    static const size_t bitsetWords = 1024;
 
-    void setBudget(string category, double limit)
+    enum class Op { AND, OR, AND_NOT };
+
+    struct Container
     {
-        if (limit < 0)
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        vector<uint16_t> values;
+        vector<uint64_t> bits;
+
+        bool isBitset() const
         {
-            cout << "Error: Negative limit!\n";
-            return;
+            return !bits.empty();
         }
-        if (category.empty())
+
+        bool contains(uint16_t v) const
         {
-            cout << "Error: Category cannot be empty!\n";
-            return;
+            if (isBitset()) return (bits[v >> 6] >> (v & 63)) & 1;
+            return binary_search(values.begin(), values.end(), v);
+        }
+
+        void toBitset()
+        {
+            bits.assign(bitsetWords, 0);
+            for (uint16_t v : values) bits[v >> 6] |= 1ULL << (v & 63);
+            vector<uint16_t>().swap(values);
+        }
+
+        void toArray()
+        {
+            values.clear();
+            values.reserve(cardinality);
+            forEach([&](uint16_t v) { values.push_back(v); });
+            vector<uint64_t>().swap(bits);
+        }
+
+        bool add(uint16_t v)
+        {
+            if (isBitset())
+            {
+                uint64_t& w = bits[v >> 6];
+                uint64_t mask = 1ULL << (v & 63);
+                if (w & mask) return false;
+                w |= mask;
+            }
+            else
+            {
+                auto it = lower_bound(values.begin(), values.end(), v);
+                if (it != values.end() && *it == v) return false;
+                values.insert(it, v);
+            }
+            if (++cardinality > arrayMax && !isBitset()) toBitset();
+            return true;
+        }
+
+        bool remove(uint16_t v)
+        {
+            if (isBitset())
+            {
+                uint64_t& w = bits[v >> 6];
+                uint64_t mask = 1ULL << (v & 63);
+                if (!(w & mask)) return false;
+                w &= ~mask;
+            }
+            else
+            {
+                auto it = lower_bound(values.begin(), values.end(), v);
+                if (it == values.end() || *it != v) return false;
+                values.erase(it);
+            }
+            if (--cardinality <= arrayMax && isBitset()) toArray();
+            return true;
         }
-        for (auto& budget : budgets)
+
+        template <typename F>
+        void forEach(F visit) const
         {
-            if (budget.getCategory() == category)
+            if (!isBitset())
             {
-                budget.setAmount(limit);
-                cout << "Budget for " << category << " updated to " << limit << endl;
+                for (uint16_t v : values) visit(v);
                 return;
             }
+            for (size_t i = 0; i < bitsetWords; ++i)
+            {
+                for (uint64_t w = bits[i]; w; w &= w - 1)
+                    visit(static_cast<uint16_t>(i * 64 + __builtin_ctzll(w)));
+            }
         }
-        budgets.push_back(Budget(category, limit));
-        cout << "New budget created for " << category << ": " << limit << endl;
-    }
 
-    void checkBudgets() const
+        void fillWords(vector<uint64_t>& words) const
+        {
+            if (isBitset())
+            {
+                words = bits;
+                return;
+            }
+            words.assign(bitsetWords, 0);
+            for (uint16_t v : values) words[v >> 6] |= 1ULL << (v & 63);
+        }
+    };
+
+    vector<Container> containers;
+
+    static Container combine(const Container& a, const Container& b, Op op)
     {
-        if (budgets.empty())
+        Container out;
+        out.key = a.key;
+        if (!a.isBitset() && !b.isBitset())
         {
-            cout << "\nNo budgets have been set yet.\n";
-            return;
+            if (op == Op::AND)
+                set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(out.values));
+            else if (op == Op::OR)
+                set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(out.values));
+            else
+                set_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(out.values));
+            out.cardinality = static_cast<uint32_t>(out.values.size());
+            if (out.cardinality > arrayMax) out.toBitset();
+            return out;
         }
-        cout << "\nBudget Status:\n";
-        for (const auto& b : budgets)
+        vector<uint64_t> x, y;
+        a.fillWords(x);
+        b.fillWords(y);
+        for (size_t i = 0; i < bitsetWords; ++i)
         {
-            string cat = b.getCategory();
-            double limit = b.getAmount();
-            double spent = calculateSpentInCategory(cat);
-            double percentage = (limit > 0) ? (spent / limit) * 100 : 0;
-            cout << cat << ": ";
-            if (spent > limit)
+            if (op == Op::AND) x[i] &= y[i];
+            else if (op == Op::OR) x[i] |= y[i];
+            else x[i] &= ~y[i];
+            out.cardinality += static_cast<uint32_t>(__builtin_popcountll(x[i]));
+        }
+        out.bits.swap(x);
+        if (out.cardinality <= arrayMax) out.toArray();
+        return out;
+    }
+
+    RoaringBitmap apply(const RoaringBitmap& other, Op op) const
+    {
+        RoaringBitmap out;
+        size_t i = 0, j = 0;
+        while (i < containers.size() || j < other.containers.size())
+        {
+            bool hasA = i < containers.size();
+            bool hasB = j < other.containers.size();
+            if (hasA && (!hasB || containers[i].key < other.containers[j].key))
             {
-                cout << "EXCEEDED by " << (spent - limit) << " (" << fixed << setprecision(1) << percentage << "%)\n";
+                if (op != Op::AND) out.containers.push_back(containers[i]);
+                ++i;
             }
-            else if (spent > limit * 0.9)
+            else if (hasB && (!hasA || other.containers[j].key < containers[i].key))
             {
-                cout << "WARNING: " << fixed << setprecision(1) << percentage << "% used (" << (limit - spent) << " remaining)\n";
+                if (op == Op::OR) out.containers.push_back(other.containers[j]);
+                ++j;
             }
             else
             {
-                cout << fixed << setprecision(1) << percentage << "% used (" << (limit - spent) << " remaining)\n";
+                Container c = combine(containers[i++], other.containers[j++], op);
+                if (c.cardinality > 0) out.containers.push_back(move(c));
             }
         }
-        cout << endl;
+        return out;
     }
 
-    void generateSummary() const
+    vector<Container>::iterator findContainer(uint16_t key)
     {
-        double income = calculateTotalIncome();
-        double expense = calculateTotalExpenses();
-        double balance = income - expense;
-        cout << "\n=== Financial Summary ===\n";
-        cout << "Total Income: " << fixed << setprecision(2) << income << endl;
-        cout << "Total Expenses: " << fixed << setprecision(2) << expense << endl;
-        cout << "Current Balance: " << fixed << setprecision(2) << balance << endl;
-        cout << "========================\n\n";
+        return lower_bound(containers.begin(), containers.end(), key,
+                           [](const Container& c, uint16_t k) { return c.key < k; });
     }
 
-    void generateDetailed(string category) const
+public:
+    void add(uint32_t x)
     {
-        if (category.empty())
+        uint16_t key = static_cast<uint16_t>(x >> 16);
+        auto it = findContainer(key);
+        if (it == containers.end() || it->key != key)
         {
-            cout << "Error: Category cannot be empty!\n";
-            return;
+            Container c;
+            c.key = key;
+            it = containers.insert(it, move(c));
         }
-        generateSummary();
-        cout << "Your Budget for category : " << category << " is " << getBudgetOfCategory(category) << endl
-             << "You spent " << calculateSpentInCategory(category) << " on this category" << endl
-             << "Details:" << endl;
-        bool found = false;
-        for (size_t i = 0; i < expenses.size(); ++i)
+        it->add(static_cast<uint16_t>(x & 0xffff));
+    }
+
+    void remove(uint32_t x)
+    {
+        uint16_t key = static_cast<uint16_t>(x >> 16);
+        auto it = findContainer(key);
+        if (it == containers.end() || it->key != key) return;
+        it->remove(static_cast<uint16_t>(x & 0xffff));
+        if (it->cardinality == 0) containers.erase(it);
+    }
+
+    // Moves every position at or after `from` by `delta` (+1 or -1), after a
+    // row was inserted or erased at `from`. Containers below it are kept.
+    void shift(uint32_t from, int delta)
+    {
+        auto first = findContainer(static_cast<uint16_t>(from >> 16));
+        vector<Container> tail(make_move_iterator(first), make_move_iterator(containers.end()));
+        containers.erase(first, containers.end());
+        for (const auto& c : tail)
         {
-            if (expenses[i].getCategory() == category)
+            uint32_t high = static_cast<uint32_t>(c.key) << 16;
+            c.forEach([&](uint16_t low)
             {
-                expenses[i].viewTrans();
-                found = true;
-            }
+                uint32_t x = high | low;
+                add(x < from ? x : x + delta);
+            });
         }
-        if (!found) cout << "No expenses found in this category.\n";
     }
 
-    void generateReportForPeriod(Date start, Date end) const
+    bool contains(uint32_t x) const
     {
-        if (start > end)
+        uint16_t key = static_cast<uint16_t>(x >> 16);
+        auto it = lower_bound(containers.begin(), containers.end(), key,
+                              [](const Container& c, uint16_t k) { return c.key < k; });
+        return it != containers.end() && it->key == key && it->contains(static_cast<uint16_t>(x & 0xffff));
+    }
+
+    size_t cardinality() const
+    {
+        size_t n = 0;
+        for (const auto& c : containers) n += c.cardinality;
+        return n;
+    }
+
+    // Every position in [0, n).
+    static RoaringBitmap range(uint32_t n)
+    {
+        RoaringBitmap out;
+        for (uint32_t start = 0; start < n; start += 65536)
         {
-            cout << "Error: The start date is newer than the end date! We will be swapping the dates.\n";
-            Date temp = start;
-            start = end;
-            end = temp;
+            Container c;
+            c.key = static_cast<uint16_t>(start >> 16);
+            c.cardinality = min<uint32_t>(n - start, 65536);
+            c.bits.assign(bitsetWords, 0);
+            for (uint32_t v = 0; v < c.cardinality; v += 64)
+                c.bits[v >> 6] = c.cardinality - v >= 64 ? ~0ULL : (1ULL << (c.cardinality - v)) - 1;
+            if (c.cardinality <= arrayMax) c.toArray();
+            out.containers.push_back(move(c));
+        }
+        return out;
+    }
+
+    RoaringBitmap operator&(const RoaringBitmap& other) const
+    {
+        return apply(other, Op::AND);
+    }
+
+    RoaringBitmap operator|(const RoaringBitmap& other) const
+    {
+        return apply(other, Op::OR);
+    }
+
+    RoaringBitmap andNot(const RoaringBitmap& other) const
+    {
+        return apply(other, Op::AND_NOT);
+    }
+
+    // Calls visit(position) in increasing order.
+    template <typename F>
+    void forEach(F visit) const
+    {
+        for (const auto& c : containers)
+        {
+            uint32_t high = static_cast<uint32_t>(c.key) << 16;
+            c.forEach([&](uint16_t low) { visit(high | low); });
+        }
+    }
+
+    size_t memoryBytes() const
+    {
+        size_t bytes = sizeof(RoaringBitmap);
+        for (const auto& c : containers) bytes += sizeof(Container) + c.values.capacity() * 2 + c.bits.capacity() * 8;
+        return bytes;
+    }
+};
+
+// Per-tag bitmaps over positions in one transaction vector. Edits, inserts
+// and deletes update it directly, shifting the later positions; rewriting
+// the whole vector (archiving) marks it stale and the next query rebuilds it.
+class TagIndex
+{
+private:
+    map<string, RoaringBitmap> bitmaps;
+    bool stale = false;
+
+public:
+    void add(size_t pos, const vector<string>& tags)
+    {
+        if (stale) return;
+        for (const auto& t : tags) bitmaps[t].add(static_cast<uint32_t>(pos));
+    }
+
+    void remove(size_t pos, const vector<string>& tags)
+    {
+        if (stale) return;
+        for (const auto& t : tags)
+        {
+            auto it = bitmaps.find(t);
+            if (it == bitmaps.end()) continue;
+            it->second.remove(static_cast<uint32_t>(pos));
+            if (it->second.cardinality() == 0) bitmaps.erase(it);
+        }
+    }
+
+    void shift(size_t from, int delta)
+    {
+        if (stale) return;
+        for (auto& b : bitmaps) b.second.shift(static_cast<uint32_t>(from), delta);
+    }
+
+    void invalidate()
+    {
+        stale = true;
+        bitmaps.clear();
+    }
+
+    template <typename T>
+    void refresh(const vector<T>& rows)
+    {
+        if (!stale) return;
+        stale = false;
+        for (size_t i = 0; i < rows.size(); ++i)
+            if (!rows[i].getTags().empty()) add(i, rows[i].getTags());
+    }
+
+    const RoaringBitmap& get(const string& tag) const
+    {
+        static const RoaringBitmap none;
+        auto it = bitmaps.find(tag);
+        return it == bitmaps.end() ? none : it->second;
+    }
+
+    const map<string, RoaringBitmap>& all() const
+    {
+        return bitmaps;
+    }
+};
+
+// Positions of each month's rows in one transaction vector, so a snapshot
+// copies the dirty months without walking the ledger. Inserting or erasing
+// a row shifts the later positions, which costs no more than the vector
+// move that caused it.
+class MonthRows
+{
+private:
+    unordered_map<int, vector<size_t>> rows;
+
+public:
+    void add(int key, size_t pos)
+    {
+        rows[key].push_back(pos);
+    }
+
+    void remove(int key, size_t pos)
+    {
+        auto it = rows.find(key);
+        if (it == rows.end()) return;
+        vector<size_t>& v = it->second;
+        auto p = find(v.begin(), v.end(), pos);
+        if (p == v.end()) return;
+        *p = v.back();
+        v.pop_back();
+        if (v.empty()) rows.erase(it);
+    }
+
+    // Moves every position at or after `from` by `delta` (+1 or -1).
+    void shift(size_t from, int delta)
+    {
+        for (auto& m : rows)
+            for (size_t& p : m.second)
+                if (p >= from) p += delta;
+    }
+
+    template <typename T>
+    void rebuild(const vector<T>& all, int (*keyOf)(const Date&))
+    {
+        rows.clear();
+        for (size_t i = 0; i < all.size(); ++i) add(keyOf(all[i].getDate()), i);
+    }
+
+    // The month's positions in vector order (the order rows are saved in).
+    vector<size_t> positions(int key) const
+    {
+        auto it = rows.find(key);
+        if (it == rows.end()) return {};
+        vector<size_t> sorted = it->second;
+        sort(sorted.begin(), sorted.end());
+        return sorted;
+    }
+};
+
+// Boolean expression over tags, e.g.
+// "trip-2026 AND (reimbursable OR tax-deductible) AND NOT personal".
+// It can be evaluated on one row's tags or on a TagIndex as bitmap operations.
+class TagQuery
+{
+private:
+    enum class Kind { TAG, AND, OR, NOT };
+
+    struct Node
+    {
+        Kind kind = Kind::TAG;
+        string tag;
+        vector<Node> children;
+    };
+
+    vector<string> tokens;
+    size_t pos = 0;
+    Node root;
+
+    string peekKeyword() const
+    {
+        if (pos >= tokens.size()) return "";
+        string s = tokens[pos];
+        for (auto& c : s) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return s;
+    }
+
+    Node parsePrimary()
+    {
+        if (pos >= tokens.size()) throw runtime_error("expected a tag at end of query");
+        string tok = tokens[pos++];
+        if (tok == "(")
+        {
+            Node inner = parseBinary(Kind::OR);
+            if (pos >= tokens.size() || tokens[pos] != ")") throw runtime_error("expected ')'");
+            ++pos;
+            return inner;
+        }
+        Node n;
+        n.tag = normalizeTag(tok);
+        if (tok == ")" || n.tag.empty()) throw runtime_error("unexpected '" + tok + "'");
+        return n;
+    }
+
+    Node parseNot()
+    {
+        if (peekKeyword() != "not") return parsePrimary();
+        ++pos;
+        Node n;
+        n.kind = Kind::NOT;
+        n.children.push_back(parseNot());
+        return n;
+    }
+
+    Node parseBinary(Kind kind)
+    {
+        bool isAnd = kind == Kind::AND;
+        Node first = isAnd ? parseNot() : parseBinary(Kind::AND);
+        if (peekKeyword() != (isAnd ? "and" : "or")) return first;
+        Node n;
+        n.kind = kind;
+        n.children.push_back(move(first));
+        while (peekKeyword() == (isAnd ? "and" : "or"))
+        {
+            ++pos;
+            n.children.push_back(isAnd ? parseNot() : parseBinary(Kind::AND));
+        }
+        return n;
+    }
+
+    static bool matchesNode(const Node& n, const vector<string>& tags)
+    {
+        if (n.kind == Kind::TAG) return binary_search(tags.begin(), tags.end(), n.tag);
+        if (n.kind == Kind::NOT) return !matchesNode(n.children[0], tags);
+        bool isAnd = n.kind == Kind::AND;
+        for (const auto& c : n.children)
+            if (matchesNode(c, tags) != isAnd) return !isAnd;
+        return isAnd;
+    }
+
+    // NOT children of an AND are subtracted instead of complemented.
+    static RoaringBitmap evaluateNode(const Node& n, const TagIndex& index, uint32_t rowCount)
+    {
+        if (n.kind == Kind::TAG) return index.get(n.tag);
+        if (n.kind == Kind::NOT) return RoaringBitmap::range(rowCount).andNot(evaluateNode(n.children[0], index, rowCount));
+        if (n.kind == Kind::OR)
+        {
+            RoaringBitmap out;
+            for (const auto& c : n.children) out = out | evaluateNode(c, index, rowCount);
+            return out;
+        }
+        RoaringBitmap out;
+        bool started = false;
+        for (const auto& c : n.children)
+        {
+            if (c.kind == Kind::NOT) continue;
+            RoaringBitmap b = evaluateNode(c, index, rowCount);
+            out = started ? out & b : b;
+            started = true;
+        }
+        if (!started) out = RoaringBitmap::range(rowCount);
+        for (const auto& c : n.children)
+            if (c.kind == Kind::NOT) out = out.andNot(evaluateNode(c.children[0], index, rowCount));
+        return out;
+    }
+
+public:
+    // Throws runtime_error with a readable message on a malformed query.
+    explicit TagQuery(const string& text)
+    {
+        string current;
+        for (size_t i = 0; i <= text.size(); ++i)
+        {
+            char c = i < text.size() ? text[i] : ' ';
+            if (c == '(' || c == ')' || isspace(static_cast<unsigned char>(c)))
+            {
+                if (!current.empty()) tokens.push_back(current);
+                current.clear();
+                if (c == '(' || c == ')') tokens.push_back(string(1, c));
+            }
+            else current += c;
+        }
+        if (tokens.empty()) throw runtime_error("empty query");
+        root = parseBinary(Kind::OR);
+        if (pos < tokens.size()) throw runtime_error("unexpected '" + tokens[pos] + "'");
+    }
+
+    bool matches(const vector<string>& tags) const
+    {
+        return matchesNode(root, tags);
+    }
+
+    RoaringBitmap evaluate(const TagIndex& index, size_t rowCount) const
+    {
+        return evaluateNode(root, index, static_cast<uint32_t>(rowCount));
+    }
+};
+
+enum class BudgetPeriod
+{
+    ALL_TIME,
+    MONTHLY,
+    WEEKLY,
+    ROLLING_DAYS
+};
+
+enum class Cadence
+{
+    DAILY,
+    WEEKLY,
+    MONTHLY,
+    YEARLY
+};
+
+// A repeating income or expense kept as one rule instead of one row per
+// occurrence. Sums over any time window are computed from the occurrence
+// count in closed form; rows are only generated for listings.
+class RecurringRule
+{
+private:
+    bool income;
+    string label;
+    double amount;
+    Cadence cadence;
+    int interval;
+    Date start;
+    Date end;
+    long long startTs;
+    long long endTs;
+
+    long long fixedPeriod() const
+    {
+        if (cadence == Cadence::DAILY) return 86400LL * interval;
+        if (cadence == Cadence::WEEKLY) return 7 * 86400LL * interval;
+        return 0;
+    }
+
+    long long monthStep() const
+    {
+        return cadence == Cadence::YEARLY ? 12LL * interval : interval;
+    }
+
+    static long long monthIndex(const Date& dt)
+    {
+        return dt.getYear() * 12LL + dt.getMonth() - 1;
+    }
+
+public:
+    RecurringRule(bool isIncome, string lbl, double amt, Cadence c, int every, Date first, Date last)
+        : income(isIncome), label(lbl), amount(amt), cadence(c), interval(every > 0 ? every : 1), start(first), end(last)
+    {
+        startTs = start.toTimestamp();
+        endTs = end.toTimestamp();
+    }
+
+    bool isIncome() const
+    {
+        return income;
+    }
+
+    const string& getLabel() const
+    {
+        return label;
+    }
+
+    double getAmount() const
+    {
+        return amount;
+    }
+
+    const Date& getStart() const
+    {
+        return start;
+    }
+
+    const Date& getEnd() const
+    {
+        return end;
+    }
+
+    // Timestamp of occurrence k (k >= 0). Monthly dates past the end of a
+    // shorter month are pinned to its last day.
+    long long occurrence(long long k) const
+    {
+        long long period = fixedPeriod();
+        if (period) return startTs + k * period;
+        long long m = monthIndex(start) + k * monthStep();
+        int y = static_cast<int>(m / 12);
+        int mo = static_cast<int>(m % 12) + 1;
+        if (y > 9999) return LLONG_MAX;
+        return Date(y, mo, min(start.getDay(), Date::daysInMonth(y, mo)), start.getTime()).toTimestamp();
+    }
+
+    // Occurrences strictly before ts, ignoring the end date.
+    long long countBefore(long long ts) const
+    {
+        if (ts <= startTs) return 0;
+        long long period = fixedPeriod();
+        if (period) return (ts - startTs - 1) / period + 1;
+        long long k = max(0LL, (monthIndex(Date::fromTimestamp(ts)) - monthIndex(start)) / monthStep());
+        while (occurrence(k) < ts) ++k;
+        while (k > 0 && occurrence(k - 1) >= ts) --k;
+        return k;
+    }
+
+    long long countBetween(long long fromTs, long long toTs) const
+    {
+        toTs = min(toTs, endTs);
+        if (fromTs > toTs) return 0;
+        return countBefore(toTs + 1) - countBefore(fromTs);
+    }
+
+    double totalBetween(long long fromTs, long long toTs) const
+    {
+        return amount * countBetween(fromTs, toTs);
+    }
+
+    // Calls visit(timestamp) for every occurrence in [fromTs, toTs].
+    template <typename F>
+    void forEachOccurrence(long long fromTs, long long toTs, F visit) const
+    {
+        toTs = min(toTs, endTs);
+        for (long long k = countBefore(fromTs); fromTs <= toTs; ++k)
+        {
+            long long ts = occurrence(k);
+            if (ts > toTs) break;
+            visit(ts);
+        }
+    }
+
+    string cadenceLabel() const
+    {
+        string unit = cadence == Cadence::DAILY ? "day" : cadence == Cadence::WEEKLY ? "week"
+                      : cadence == Cadence::MONTHLY ? "month" : "year";
+        return interval == 1 ? "every " + unit : "every " + to_string(interval) + " " + unit + "s";
+    }
+
+    // Format: RULE,INCOME|EXPENSE,label,amount,DAILY|WEEKLY|MONTHLY|YEARLY,interval,start,end
+    void writeRecord(ostream& out) const
+    {
+        static const char* names[] = {"DAILY", "WEEKLY", "MONTHLY", "YEARLY"};
+        out << "RULE," << (income ? "INCOME," : "EXPENSE,") << label << "," << amount << ","
+            << names[static_cast<int>(cadence)] << "," << interval << "," << start.toString() << "," << end.toString() << "\n";
+    }
+
+    static bool parseCadence(const string& text, Cadence& c)
+    {
+        if (text == "DAILY") c = Cadence::DAILY;
+        else if (text == "WEEKLY") c = Cadence::WEEKLY;
+        else if (text == "MONTHLY") c = Cadence::MONTHLY;
+        else if (text == "YEARLY") c = Cadence::YEARLY;
+        else return false;
+        return true;
+    }
+};
+
+inline const string& transactionLabel(const Income& inc)
+{
+    return inc.getSource();
+}
+
+inline const string& transactionLabel(const Expense& exp)
+{
+    return exp.getCategory();
+}
+
+void writeRecord(ostream& out, const Income& inc)
+{
+    out << "INCOME," << inc.getSource() << "," << inc.getAmount() << "," << inc.getDate().toString();
+    if (!inc.getTags().empty() || inc.getCurrency() != 0) out << "," << joinTags(inc.getTags());
+    if (inc.getCurrency() != 0) out << "," << Currency::code(inc.getCurrency());
+    out << "\n";
+}
+
+void writeRecord(ostream& out, const Expense& exp)
+{
+    out << "EXPENSE," << exp.getCategory() << "," << exp.getAmount() << "," << exp.getDate().toString();
+    if (!exp.getTags().empty() || exp.getCurrency() != 0) out << "," << joinTags(exp.getTags());
+    if (exp.getCurrency() != 0) out << "," << Currency::code(exp.getCurrency());
+    out << "\n";
+}
+
+class Budget
+{
+private:
+    string category;
+    double amount;
+    BudgetPeriod period;
+    int rollingDays;
+
+public:
+    Budget(string cat, double amt, BudgetPeriod p = BudgetPeriod::ALL_TIME, int days = 0)
+        : category(cat), amount(amt), period(p), rollingDays(p == BudgetPeriod::ROLLING_DAYS ? days : 0) {}
+
+    void setCategory(string cat)
+    {
+        category = cat;
+    }
+
+    string getCategory() const
+    {
+        return category;
+    }
+
+    double getAmount() const
+    {
+        return amount;
+    }
+
+    void setAmount(double amt)
+    {
+        amount = amt;
+    }
+
+    BudgetPeriod getPeriod() const
+    {
+        return period;
+    }
+
+    int getRollingDays() const
+    {
+        return rollingDays;
+    }
+
+    bool samePeriod(BudgetPeriod p, int days) const
+    {
+        return period == p && (p != BudgetPeriod::ROLLING_DAYS || rollingDays == days);
+    }
+
+    string periodLabel() const
+    {
+        if (period == BudgetPeriod::MONTHLY) return "monthly";
+        if (period == BudgetPeriod::WEEKLY) return "weekly";
+        if (period == BudgetPeriod::ROLLING_DAYS) return "last " + to_string(rollingDays) + " days";
+        return "all time";
+    }
+
+    // Persisted as the fourth BUDGET field; empty for all-time budgets.
+    string periodCode() const
+    {
+        if (period == BudgetPeriod::MONTHLY) return "MONTHLY";
+        if (period == BudgetPeriod::WEEKLY) return "WEEKLY";
+        if (period == BudgetPeriod::ROLLING_DAYS) return "ROLLING:" + to_string(rollingDays);
+        return "";
+    }
+
+    static bool parsePeriodCode(const string& code, BudgetPeriod& p, int& days)
+    {
+        days = 0;
+        if (code.empty() || code == "ALL") p = BudgetPeriod::ALL_TIME;
+        else if (code == "MONTHLY") p = BudgetPeriod::MONTHLY;
+        else if (code == "WEEKLY") p = BudgetPeriod::WEEKLY;
+        else if (code.compare(0, 8, "ROLLING:") == 0 && isValidInt(code.substr(8)))
+        {
+            p = BudgetPeriod::ROLLING_DAYS;
+            days = stoi(code.substr(8));
+            if (days <= 0) return false;
+        }
+        else return false;
+        return true;
+    }
+};
+
+// Per-day amounts with a Fenwick tree on top, so any [from, to] day window
+// is summed in O(log n) without touching rows. Days live in fixed chunks
+// created on first use, so one row dated 1900 or 9999 costs a chunk, not a
+// dense array across the gap; a prefix sum adds the totals of the earlier
+// chunks (a handful for any real ledger).
+class DailyTotals
+{
+private:
+    static constexpr long long chunkDays = 1024;
+
+    struct Chunk
+    {
+        double total = 0;
+        vector<double> daily = vector<double>(chunkDays, 0);
+        vector<double> tree = vector<double>(chunkDays + 1, 0);
+    };
+
+    map<long long, Chunk> chunks;
+
+    static long long chunkOf(long long day)
+    {
+        return day >= 0 ? day / chunkDays : -((-day + chunkDays - 1) / chunkDays);
+    }
+
+public:
+    bool empty() const
+    {
+        return chunks.empty();
+    }
+
+    void add(long long day, double amt)
+    {
+        long long c = chunkOf(day);
+        Chunk& chunk = chunks[c];
+        size_t pos = static_cast<size_t>(day - c * chunkDays);
+        chunk.total += amt;
+        chunk.daily[pos] += amt;
+        for (size_t i = pos + 1; i < chunk.tree.size(); i += i & (~i + 1)) chunk.tree[i] += amt;
+    }
+
+    double dayTotal(long long day) const
+    {
+        auto it = chunks.find(chunkOf(day));
+        if (it == chunks.end()) return 0;
+        return it->second.daily[static_cast<size_t>(day - it->first * chunkDays)];
+    }
+
+    // Sum of every day up to and including `day`.
+    double sumUpTo(long long day) const
+    {
+        long long c = chunkOf(day);
+        double total = 0;
+        auto it = chunks.begin();
+        for (; it != chunks.end() && it->first < c; ++it) total += it->second.total;
+        if (it == chunks.end() || it->first != c) return total;
+        for (size_t i = static_cast<size_t>(day - c * chunkDays) + 1; i > 0; i -= i & (~i + 1)) total += it->second.tree[i];
+        return total;
+    }
+
+    double sumRange(long long fromDay, long long toDay) const
+    {
+        if (fromDay > toDay) return 0;
+        return sumUpTo(toDay) - sumUpTo(fromDay - 1);
+    }
+};
+
+// Categories form a tree through '/' in their names: "food/groceries" is a
+// child of "food". Levels are trimmed and empty ones dropped, so
+// "/food// groceries /" is "food/groceries".
+string normalizeCategory(const string& path)
+{
+    string result;
+    stringstream ss(path);
+    string level;
+    while (getline(ss, level, '/'))
+    {
+        size_t first = level.find_first_not_of(" \t");
+        if (first == string::npos) continue;
+        level = level.substr(first, level.find_last_not_of(" \t") - first + 1);
+        if (!result.empty()) result += '/';
+        result += level;
+    }
+    return result;
+}
+
+// True when label is category itself or anywhere below it.
+bool inCategory(const string& label, const string& category)
+{
+    if (label.size() < category.size() || label.compare(0, category.size(), category) != 0) return false;
+    return label.size() == category.size() || label[category.size()] == '/';
+}
+
+// The level below `category` that label falls under ("food/groceries/fruit"
+// under "food" is "food/groceries"); empty when label is not strictly below.
+string childCategory(const string& label, const string& category)
+{
+    if (label.size() <= category.size() || !inCategory(label, category)) return "";
+    size_t end = label.find('/', category.size() + 1);
+    return label.substr(0, end);
+}
+
+// Expense totals per node of the category tree. Adding to a category adds
+// to it and every ancestor, so a subtree total is one lookup and an update
+// costs O(depth).
+class CategoryTree
+{
+private:
+    struct Node
+    {
+        double total = 0;
+        DailyTotals daily;
+        set<string> children;
+    };
+
+    map<string, Node> nodes;
+
+public:
+    void add(const string& category, long long day, double amt)
+    {
+        string path = category, child;
+        while (true)
+        {
+            Node& node = nodes[path];
+            node.total += amt;
+            node.daily.add(day, amt);
+            if (!child.empty()) node.children.insert(child);
+            size_t slash = path.rfind('/');
+            if (slash == string::npos) break;
+            child = path;
+            path.resize(slash);
+        }
+    }
+
+    double subtreeTotal(const string& category) const
+    {
+        auto it = nodes.find(category);
+        return it == nodes.end() ? 0 : it->second.total;
+    }
+
+    double subtreeRange(const string& category, long long fromDay, long long toDay) const
+    {
+        auto it = nodes.find(category);
+        return it == nodes.end() ? 0 : it->second.daily.sumRange(fromDay, toDay);
+    }
+
+    const set<string>& children(const string& category) const
+    {
+        static const set<string> none;
+        auto it = nodes.find(category);
+        return it == nodes.end() ? none : it->second.children;
+    }
+};
+
+// A read-only ledger of fixed-width rows that is memory-mapped and scanned
+// in place (out-of-core mode). Rows are sorted by timestamp, so date ranges
+// are found by binary search. Scans walk the file one window at a time and
+// release each window's pages when done, so resident memory stays around
+// one window however large the file is. Opening only maps the file.
+//
+// Layout: a 64-byte header starting with "FTFW1", then 64-byte rows.
+class MappedLedger
+{
+public:
+    struct Row
+    {
+        int64_t ts;
+        int64_t cents;
+        uint8_t isIncome;
+        uint8_t labelLength;
+        char label[46];
+    };
+    static_assert(sizeof(Row) == 64, "fixed-width rows are 64 bytes");
+
+    static constexpr size_t headerBytes = 64;
+    static constexpr size_t maxLabel = sizeof(Row::label);
+
+private:
+    static constexpr size_t windowRows = (32 << 20) / sizeof(Row);
+
+    const char* base = nullptr;
+    size_t bytes = 0;
+    size_t rows = 0;
+    mutable bool totalsKnown = false;
+    mutable long long incomeCents = 0;
+    mutable long long expenseCents = 0;
+    mutable map<string, long long> categoryCents;
+
+    const Row* data() const
+    {
+        return reinterpret_cast<const Row*>(base + headerBytes);
+    }
+
+    // Rows are not checked when the file is opened (that would cost a full
+    // scan), so a corrupt length byte is clamped to the label field.
+    static size_t labelSize(const Row& r)
+    {
+        return min<size_t>(r.labelLength, maxLabel);
+    }
+
+    static bool labelIn(const Row& r, const string& category)
+    {
+        size_t n = category.size();
+        size_t length = labelSize(r);
+        return length >= n && memcmp(r.label, category.data(), n) == 0 && (length == n || r.label[n] == '/');
+    }
+
+public:
+    MappedLedger() = default;
+    MappedLedger(const MappedLedger&) = delete;
+    MappedLedger& operator=(const MappedLedger&) = delete;
+
+    ~MappedLedger()
+    {
+#ifndef _WIN32
+        if (base) munmap(const_cast<char*>(base), bytes);
+#endif
+    }
+
+    bool open(const string& filename, string& error)
+    {
+#ifdef _WIN32
+        error = "memory-mapped ledgers need a POSIX system";
+        return false;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0) close(fd);
+            error = "cannot open " + filename;
+            return false;
+        }
+        bytes = st.st_size;
+        void* map = bytes >= headerBytes ? mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            error = filename + " is not a fixed-width ledger";
+            return false;
+        }
+        base = static_cast<const char*>(map);
+        if (memcmp(base, "FTFW1", 5) != 0 || (bytes - headerBytes) % sizeof(Row) != 0)
+        {
+            munmap(map, bytes);
+            base = nullptr;
+            error = filename + " is not a fixed-width ledger";
+            return false;
+        }
+        rows = (bytes - headerBytes) / sizeof(Row);
+        madvise(map, bytes, MADV_SEQUENTIAL);
+        return true;
+#endif
+    }
+
+    size_t size() const
+    {
+        return rows;
+    }
+
+    static string labelOf(const Row& r)
+    {
+        return string(r.label, labelSize(r));
+    }
+
+    // Fills a row; false when the label had to be truncated.
+    static bool encode(bool isIncome, const string& label, long long cents, long long ts, Row& r)
+    {
+        memset(&r, 0, sizeof(r));
+        r.ts = ts;
+        r.cents = cents;
+        r.isIncome = isIncome;
+        r.labelLength = static_cast<uint8_t>(min(label.size(), maxLabel));
+        memcpy(r.label, label.data(), r.labelLength);
+        return label.size() <= maxLabel;
+    }
+
+    static string header()
+    {
+        string h(headerBytes, '\0');
+        h.replace(0, 6, "FTFW1\n");
+        return h;
+    }
+
+    // First row at or after ts.
+    size_t lowerBound(long long ts) const
+    {
+        const Row* first = data();
+        return lower_bound(first, first + rows, ts, [](const Row& r, long long t) { return r.ts < t; }) - first;
+    }
+
+    // Calls f(row) for rows [from, to), releasing pages behind the cursor.
+    template <typename F>
+    void scan(size_t from, size_t to, F f) const
+    {
+#ifndef _WIN32
+        const long page = sysconf(_SC_PAGESIZE);
+#endif
+        for (size_t start = from; start < to; start += windowRows)
+        {
+            size_t end = min(to, start + windowRows);
+            for (size_t i = start; i < end; ++i) f(data()[i]);
+#ifndef _WIN32
+            uintptr_t lo = reinterpret_cast<uintptr_t>(data() + start) & ~(page - 1);
+            uintptr_t hi = reinterpret_cast<uintptr_t>(data() + end) & ~(page - 1);
+            if (hi > lo) madvise(reinterpret_cast<void*>(lo), hi - lo, MADV_DONTNEED);
+#endif
+        }
+    }
+
+    template <typename F>
+    void scanRange(long long fromTs, long long toTs, F f) const
+    {
+        if (fromTs > toTs) return;
+        scan(lowerBound(fromTs), toTs == LLONG_MAX ? rows : lowerBound(toTs + 1), f);
+    }
+
+    // The file never changes while mapped, so whole-file sums are computed once.
+    long long getIncomeCents() const
+    {
+        if (!totalsKnown)
+        {
+            incomeCents = expenseCents = 0;
+            scan(0, rows, [&](const Row& r) { (r.isIncome ? incomeCents : expenseCents) += r.cents; });
+            totalsKnown = true;
+        }
+        return incomeCents;
+    }
+
+    long long getExpenseCents() const
+    {
+        getIncomeCents();
+        return expenseCents;
+    }
+
+    long long spentInCategory(const string& category) const
+    {
+        auto it = categoryCents.find(category);
+        if (it != categoryCents.end()) return it->second;
+        return categoryCents[category] = spentInCategory(category, LLONG_MIN, LLONG_MAX);
+    }
+
+    long long spentInCategory(const string& category, long long fromTs, long long toTs) const
+    {
+        long long total = 0;
+        scanRange(fromTs, toTs, [&](const Row& r) { if (!r.isIncome && labelIn(r, category)) total += r.cents; });
+        return total;
+    }
+
+    template <typename F>
+    void forEachInCategory(const string& category, F f) const
+    {
+        scan(0, rows, [&](const Row& r) { if (!r.isIncome && labelIn(r, category)) f(r); });
+    }
+
+    long long netCentsUpTo(long long ts) const
+    {
+        long long net = 0;
+        scanRange(LLONG_MIN, ts, [&](const Row& r) { net += r.isIncome ? r.cents : -r.cents; });
+        return net;
+    }
+};
+
+// Quantile sketch in the style of DDSketch: amounts fall into logarithmic
+// buckets whose width is 2% of their value, so any quantile comes back
+// within 1% of the true amount. Counts live in a dense array offset by the
+// smallest bucket, so adding and removing are O(1) and removal is exact.
+class QuantileSketch
+{
+private:
+    static constexpr double relativeAccuracy = 0.01;
+    static constexpr double minAmount = 0.005;
+
+    long long zeroCount = 0;
+    int offset = 0;
+    vector<long long> counts;
+
+    static double logGamma()
+    {
+        static const double value = log((1 + relativeAccuracy) / (1 - relativeAccuracy));
+        return value;
+    }
+
+    static int bucketOf(double amount)
+    {
+        return static_cast<int>(ceil(log(amount) / logGamma()));
+    }
+
+    static double bucketValue(int bucket)
+    {
+        return 2 * exp(bucket * logGamma()) / (1 + exp(logGamma()));
+    }
+
+    long long& slot(int bucket)
+    {
+        if (counts.empty())
+        {
+            offset = bucket;
+            counts.assign(1, 0);
+        }
+        else if (bucket < offset)
+        {
+            counts.insert(counts.begin(), offset - bucket, 0);
+            offset = bucket;
+        }
+        else if (bucket >= offset + static_cast<int>(counts.size()))
+        {
+            counts.resize(bucket - offset + 1, 0);
+        }
+        return counts[bucket - offset];
+    }
+
+public:
+    void add(double amount, long long weight = 1)
+    {
+        if (amount < minAmount) zeroCount += weight;
+        else slot(bucketOf(amount)) += weight;
+    }
+
+    void remove(double amount)
+    {
+        if (amount < minAmount)
+        {
+            if (zeroCount > 0) --zeroCount;
+            return;
+        }
+        int bucket = bucketOf(amount);
+        if (bucket >= offset && bucket < offset + static_cast<int>(counts.size()) && counts[bucket - offset] > 0)
+            --counts[bucket - offset];
+    }
+
+    long long count() const
+    {
+        long long n = zeroCount;
+        for (long long c : counts) n += c;
+        return n;
+    }
+
+    // q in [0, 1]; 0 when the sketch is empty.
+    double quantile(double q) const
+    {
+        long long n = count();
+        if (n == 0) return 0;
+        long long rank = static_cast<long long>(q * (n - 1));
+        long long seen = zeroCount;
+        if (seen > rank) return 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            seen += counts[i];
+            if (seen > rank) return bucketValue(offset + static_cast<int>(i));
+        }
+        return bucketValue(offset + static_cast<int>(counts.size()) - 1);
+    }
+
+    // "zero|bucket:count;bucket:count..." with empty buckets left out.
+    string encode() const
+    {
+        ostringstream out;
+        out << zeroCount << "|";
+        bool first = true;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] == 0) continue;
+            if (!first) out << ";";
+            out << offset + static_cast<int>(i) << ":" << counts[i];
+            first = false;
+        }
+        return out.str();
+    }
+
+    static bool decode(const string& text, QuantileSketch& sketch)
+    {
+        size_t bar = text.find('|');
+        if (bar == string::npos || !isValidInt(text.substr(0, bar))) return false;
+        sketch = QuantileSketch();
+        sketch.zeroCount = stoll(text.substr(0, bar));
+        stringstream ss(text.substr(bar + 1));
+        string pair;
+        while (getline(ss, pair, ';'))
+        {
+            int bucket;
+            long long c;
+            if (sscanf(pair.c_str(), "%d:%lld", &bucket, &c) != 2 || c < 0) return false;
+            sketch.slot(bucket) += c;
+        }
+        return true;
+    }
+};
+
+// Running count, mean and variance (Welford's update, reversible for
+// deletes) plus a quantile sketch of the amounts of one category or source.
+class AmountStats
+{
+private:
+    long long n = 0;
+    double mean = 0;
+    double m2 = 0;
+    QuantileSketch sketch;
+
+public:
+    static const long long minSamples = 20;
+
+    void add(double x)
+    {
+        ++n;
+        double delta = x - mean;
+        mean += delta / n;
+        m2 += delta * (x - mean);
+        sketch.add(x);
+    }
+
+    void remove(double x)
+    {
+        if (n <= 1)
+        {
+            *this = AmountStats();
+            return;
+        }
+        double oldMean = mean;
+        mean = (n * mean - x) / (n - 1);
+        m2 = max(0.0, m2 - (x - oldMean) * (x - mean));
+        --n;
+        sketch.remove(x);
+    }
+
+    long long getCount() const
+    {
+        return n;
+    }
+
+    double getMean() const
+    {
+        return mean;
+    }
+
+    double getStdDev() const
+    {
+        return n > 1 ? sqrt(m2 / (n - 1)) : 0;
+    }
+
+    double quantile(double q) const
+    {
+        return sketch.quantile(q);
+    }
+
+    // Unusual means more than three standard deviations above the mean and
+    // above the 99th percentile, once there is enough history to judge.
+    bool isUnusual(double x) const
+    {
+        return n >= minSamples && x > mean + 3 * getStdDev() && x > quantile(0.99);
+    }
+
+    // Format: count,mean,m2,sketch
+    void write(ostream& out) const
+    {
+        streamsize old = out.precision(17);
+        out << n << "," << mean << "," << m2 << "," << sketch.encode();
+        out.precision(old);
+    }
+
+    static bool parse(const string& text, AmountStats& stats)
+    {
+        stringstream ss(text);
+        string count, meanText, m2Text, sketchText;
+        getline(ss, count, ',');
+        getline(ss, meanText, ',');
+        getline(ss, m2Text, ',');
+        getline(ss, sketchText);
+        if (!isValidInt(count) || !isValidDouble(meanText) || !isValidDouble(m2Text)) return false;
+        AmountStats s;
+        s.n = stoll(count);
+        s.mean = stod(meanText);
+        s.m2 = stod(m2Text);
+        if (!QuantileSketch::decode(sketchText, s.sketch)) return false;
+        stats = s;
+        return true;
+    }
+};
+
+// Average daily amount per income source and expense category, blended
+// from the last 30, 90 and 365 days so recent habits count most. Rows are
+// added and removed as the ledger changes. Windows longer than the history
+// so far are shortened to it, so a new ledger does not read as a slow one.
+class SpendingRateModel
+{
+private:
+    map<string, DailyTotals> incomeDaily;
+    map<string, DailyTotals> expenseDaily;
+    map<long long, size_t> rowsPerDay;
+
+    static double blendedRate(const DailyTotals& daily, long long today, long long history)
+    {
+        static const long long windows[] = {30, 90, 365};
+        static const double weights[] = {0.5, 0.3, 0.2};
+        double rate = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            long long days = min(windows[i], history);
+            rate += weights[i] * daily.sumRange(today - days + 1, today) / days;
+        }
+        return rate;
+    }
+
+public:
+    // `amt` is signed: negative with sign -1 takes a row back out.
+    void add(bool isIncome, const string& label, long long day, double amt, int sign)
+    {
+        (isIncome ? incomeDaily : expenseDaily)[label].add(day, amt);
+        auto it = rowsPerDay.emplace(day, 0).first;
+        if (sign > 0) it->second++;
+        else if (it->second <= 1) rowsPerDay.erase(it);
+        else it->second--;
+    }
+
+    // Days from the first transaction through today (0 without history).
+    long long historyDays(long long today) const
+    {
+        if (rowsPerDay.empty() || rowsPerDay.begin()->first > today) return 0;
+        return today - rowsPerDay.begin()->first + 1;
+    }
+
+    // Daily rate of every label, or only of those under `category`.
+    double dailyRate(bool isIncome, const string* category, long long today) const
+    {
+        long long history = historyDays(today);
+        if (history == 0) return 0;
+        double rate = 0;
+        for (const auto& entry : isIncome ? incomeDaily : expenseDaily)
+        {
+            if (!category || inCategory(entry.first, *category)) rate += blendedRate(entry.second, today, history);
+        }
+        return rate;
+    }
+};
+
+// One calendar month of the on-disk ledger (finance_data/YYYY-MM.csv).
+struct PartitionInfo
+{
+    size_t incomeCount = 0;
+    size_t expenseCount = 0;
+    double incomeSum = 0;
+    double expenseSum = 0;
+    bool loaded = false;
+};
+
+long long toCents(double amount)
+{
+    return llround(amount * 100);
+}
+
+// 64-bit content hash of a transaction; two rows with the same type, label,
+// amount in cents, currency (0 = base) and timestamp always hash alike.
+uint64_t rowFingerprint(bool isIncome, const string& label, long long cents, uint16_t currency, long long ts)
+{
+    uint64_t h = hash<string>()(label) ^ (isIncome ? 0x9e3779b97f4a7c15ULL : 0);
+    for (uint64_t v : {static_cast<uint64_t>(cents), static_cast<uint64_t>(currency), static_cast<uint64_t>(ts)})
+    {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h ^= h >> 31;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// How an import treats rows the ledger already holds. SKIP drops any row
+// that matches, FLAG imports it but reports it, MERGE pairs rows one to one
+// so a file with three identical rows against two in the ledger adds one.
+enum class DuplicatePolicy
+{
+    SKIP,
+    FLAG,
+    MERGE
+};
+
+struct ImportResult
+{
+    size_t imported = 0;
+    size_t duplicates = 0;
+    size_t invalid = 0;
+    vector<int> flaggedLines;
+};
+
+// Writes to path.tmp, fsyncs and renames over path.
+bool writeFileDurably(const filesystem::path& path, const string& contents)
+{
+    filesystem::path tmp = path;
+    tmp += ".tmp";
+    FILE* f = fopen(tmp.string().c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size() && fflush(f) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    ok = fclose(f) == 0 && ok;
+    error_code ec;
+    if (ok) filesystem::rename(tmp, path, ec);
+    return ok && !ec;
+}
+
+struct ArchivedRow
+{
+    long long timestamp;
+    bool isIncome;
+    string label;
+    long long cents;
+    string tags;
+};
+
+// One closed year of transactions, stored compressed: rows sorted by time
+// with delta-encoded timestamps, dictionary-coded sources/categories and
+// fixed-point cents, all as varints. Blocks with tagged rows add a
+// dictionary-coded tag set per row. The summary fields answer totals and
+// per-category sums without decoding the payload.
+class ColdBlock
+{
+private:
+    int year = 0;
+    long long minTimestamp = 0;
+    long long maxTimestamp = 0;
+    size_t incomeCount = 0;
+    size_t expenseCount = 0;
+    long long incomeCents = 0;
+    long long expenseCents = 0;
+    vector<string> dictionary;
+    vector<string> tagSets;
+    map<string, long long> categoryCents;
+    string payload;
+
+    static void putVarint(string& out, unsigned long long v)
+    {
+        while (v >= 0x80)
+        {
+            out += static_cast<char>((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        out += static_cast<char>(v);
+    }
+
+    static unsigned long long getVarint(const char*& p, const char* end)
+    {
+        unsigned long long v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7)
+        {
+            unsigned char b = static_cast<unsigned char>(*p++);
+            v |= static_cast<unsigned long long>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw runtime_error("truncated varint");
+    }
+
+    static unsigned long long zigzag(long long v)
+    {
+        return (static_cast<unsigned long long>(v) << 1) ^ static_cast<unsigned long long>(v >> 63);
+    }
+
+    static long long unzigzag(unsigned long long v)
+    {
+        return static_cast<long long>(v >> 1) ^ -static_cast<long long>(v & 1);
+    }
+
+public:
+    static ColdBlock build(int year, vector<ArchivedRow>& rows)
+    {
+        sort(rows.begin(), rows.end(),
+             [](const ArchivedRow& a, const ArchivedRow& b) { return a.timestamp < b.timestamp; });
+        ColdBlock block;
+        block.year = year;
+        if (!rows.empty())
+        {
+            block.minTimestamp = rows.front().timestamp;
+            block.maxTimestamp = rows.back().timestamp;
+        }
+        map<string, size_t> ids;
+        map<string, size_t> tagIds;
+        if (any_of(rows.begin(), rows.end(), [](const ArchivedRow& r) { return !r.tags.empty(); }))
+        {
+            tagIds[""] = 0;
+            block.tagSets.push_back("");
+        }
+        long long prev = block.minTimestamp;
+        for (const auto& r : rows)
+        {
+            auto found = ids.find(r.label);
+            if (found == ids.end())
+            {
+                found = ids.emplace(r.label, block.dictionary.size()).first;
+                block.dictionary.push_back(r.label);
+            }
+            putVarint(block.payload, static_cast<unsigned long long>(r.timestamp - prev));
+            putVarint(block.payload, (static_cast<unsigned long long>(found->second) << 1) | (r.isIncome ? 1 : 0));
+            putVarint(block.payload, zigzag(r.cents));
+            if (!block.tagSets.empty())
+            {
+                auto tagId = tagIds.find(r.tags);
+                if (tagId == tagIds.end())
+                {
+                    tagId = tagIds.emplace(r.tags, block.tagSets.size()).first;
+                    block.tagSets.push_back(r.tags);
+                }
+                putVarint(block.payload, tagId->second);
+            }
+            prev = r.timestamp;
+
+            if (r.isIncome)
+            {
+                block.incomeCount++;
+                block.incomeCents += r.cents;
+            }
+            else
+            {
+                block.expenseCount++;
+                block.expenseCents += r.cents;
+                block.categoryCents[r.label] += r.cents;
+            }
+        }
+        block.payload.shrink_to_fit();
+        return block;
+    }
+
+    // Calls visit(isIncome, label, cents, timestamp, tags) for every row in
+    // time order; tags are joined with ';'.
+    template <typename F>
+    void forEachTaggedRow(F visit) const
+    {
+        static const string untagged;
+        const char* p = payload.data();
+        const char* end = p + payload.size();
+        long long ts = minTimestamp;
+        while (p < end)
+        {
+            ts += static_cast<long long>(getVarint(p, end));
+            unsigned long long tag = getVarint(p, end);
+            long long cents = unzigzag(getVarint(p, end));
+            const string& tags = tagSets.empty() ? untagged : tagSets.at(static_cast<size_t>(getVarint(p, end)));
+            visit((tag & 1) != 0, dictionary.at(static_cast<size_t>(tag >> 1)), cents, ts, tags);
+        }
+    }
+
+    // Calls visit(isIncome, label, cents, timestamp) for every row in time order.
+    template <typename F>
+    void forEachRow(F visit) const
+    {
+        forEachTaggedRow([&](bool isIncome, const string& label, long long cents, long long ts, const string&)
+        {
+            visit(isIncome, label, cents, ts);
+        });
+    }
+
+    bool hasTags() const
+    {
+        return !tagSets.empty();
+    }
+
+    int getYear() const
+    {
+        return year;
+    }
+
+    size_t rowCount() const
+    {
+        return incomeCount + expenseCount;
+    }
+
+    long long getIncomeCents() const
+    {
+        return incomeCents;
+    }
+
+    long long getExpenseCents() const
+    {
+        return expenseCents;
+    }
+
+    bool overlaps(long long fromTs, long long toTs) const
+    {
+        return rowCount() > 0 && fromTs <= maxTimestamp && toTs >= minTimestamp;
+    }
+
+    bool hasCategory(const string& category) const
+    {
+        for (auto it = categoryCents.lower_bound(category); it != categoryCents.end(); ++it)
+        {
+            if (inCategory(it->first, category)) return true;
+            if (it->first.compare(0, category.size(), category) != 0) break;
+        }
+        return false;
+    }
+
+    // Includes subcategories; their names sort right after the parent's.
+    long long spentInCategory(const string& category) const
+    {
+        long long total = 0;
+        for (auto it = categoryCents.lower_bound(category); it != categoryCents.end(); ++it)
+        {
+            if (inCategory(it->first, category)) total += it->second;
+            else if (it->first.compare(0, category.size(), category) != 0) break;
+        }
+        return total;
+    }
+
+    const map<string, long long>& getCategoryCents() const
+    {
+        return categoryCents;
+    }
+
+    // Expense cents of one category in [fromTs, toTs]; decodes only when the window cuts the block.
+    long long spentInCategory(const string& category, long long fromTs, long long toTs) const
+    {
+        if (!overlaps(fromTs, toTs) || !hasCategory(category)) return 0;
+        if (fromTs <= minTimestamp && toTs >= maxTimestamp) return spentInCategory(category);
+        long long total = 0;
+        forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+        {
+            if (!isIncome && ts >= fromTs && ts <= toTs && inCategory(label, category)) total += cents;
+        });
+        return total;
+    }
+
+    // Income minus expenses, in cents, for rows at or before ts.
+    long long netCentsUpTo(long long ts) const
+    {
+        if (rowCount() == 0 || ts < minTimestamp) return 0;
+        if (ts >= maxTimestamp) return incomeCents - expenseCents;
+        long long net = 0;
+        forEachRow([&](bool isIncome, const string&, long long cents, long long rowTs)
+        {
+            if (rowTs <= ts) net += isIncome ? cents : -cents;
+        });
+        return net;
+    }
+
+    size_t memoryBytes() const
+    {
+        size_t bytes = sizeof(ColdBlock) + payload.size();
+        for (const auto& s : dictionary) bytes += sizeof(string) + s.capacity();
+        for (const auto& s : tagSets) bytes += sizeof(string) + s.capacity();
+        for (const auto& c : categoryCents) bytes += sizeof(c) + c.first.capacity() + 32;
+        return bytes;
+    }
+
+    string serialize() const
+    {
+        string out = tagSets.empty() ? "FTCB1" : "FTCB2";
+        putVarint(out, static_cast<unsigned long long>(year));
+        putVarint(out, zigzag(minTimestamp));
+        putVarint(out, zigzag(maxTimestamp));
+        putVarint(out, incomeCount);
+        putVarint(out, expenseCount);
+        putVarint(out, zigzag(incomeCents));
+        putVarint(out, zigzag(expenseCents));
+        putVarint(out, dictionary.size());
+        for (const auto& s : dictionary)
+        {
+            putVarint(out, s.size());
+            out += s;
+        }
+        if (!tagSets.empty())
+        {
+            putVarint(out, tagSets.size());
+            for (const auto& s : tagSets)
+            {
+                putVarint(out, s.size());
+                out += s;
+            }
+        }
+        putVarint(out, categoryCents.size());
+        for (const auto& c : categoryCents)
+        {
+            putVarint(out, c.first.size());
+            out += c.first;
+            putVarint(out, zigzag(c.second));
+        }
+        putVarint(out, payload.size());
+        out += payload;
+        return out;
+    }
+
+    // Reads both layouts (FTCB1 without tags, FTCB2 with tag sets).
+    // Throws runtime_error on a damaged block.
+    static ColdBlock parse(const string& bytes)
+    {
+        bool tagged = bytes.compare(0, 5, "FTCB2") == 0;
+        if (!tagged && bytes.compare(0, 5, "FTCB1") != 0) throw runtime_error("not a cold block");
+        const char* p = bytes.data() + 5;
+        const char* end = bytes.data() + bytes.size();
+        auto readString = [&]()
+        {
+            size_t len = static_cast<size_t>(getVarint(p, end));
+            if (static_cast<size_t>(end - p) < len) throw runtime_error("truncated block");
+            string s(p, len);
+            p += len;
+            return s;
+        };
+
+        ColdBlock block;
+        block.year = static_cast<int>(getVarint(p, end));
+        block.minTimestamp = unzigzag(getVarint(p, end));
+        block.maxTimestamp = unzigzag(getVarint(p, end));
+        block.incomeCount = static_cast<size_t>(getVarint(p, end));
+        block.expenseCount = static_cast<size_t>(getVarint(p, end));
+        block.incomeCents = unzigzag(getVarint(p, end));
+        block.expenseCents = unzigzag(getVarint(p, end));
+        size_t words = static_cast<size_t>(getVarint(p, end));
+        for (size_t i = 0; i < words; ++i) block.dictionary.push_back(readString());
+        size_t sets = tagged ? static_cast<size_t>(getVarint(p, end)) : 0;
+        for (size_t i = 0; i < sets; ++i) block.tagSets.push_back(readString());
+        size_t categories = static_cast<size_t>(getVarint(p, end));
+        for (size_t i = 0; i < categories; ++i)
+        {
+            string name = readString();
+            block.categoryCents[name] = unzigzag(getVarint(p, end));
+        }
+        block.payload = readString();
+        return block;
+    }
+};
+
+// One transaction on either side of a reconciliation. Amounts are signed
+// cents (incomes positive) so both sides compare exactly.
+struct ReconcileRow
+{
+    long long ts = 0;
+    long long cents = 0;
+    long long line = 0;
+    string label;
+
+    bool operator<(const ReconcileRow& other) const
+    {
+        if (ts != other.ts) return ts < other.ts;
+        return cents < other.cents;
+    }
+
+    bool operator>(const ReconcileRow& other) const
+    {
+        return other < *this;
+    }
+};
+
+// Accepts the save file layout (INCOME,source,amount,date) and the usual
+// bank layout (date,signed amount[,description]).
+bool parseStatementLine(const string& line, ReconcileRow& row)
+{
+    size_t c1 = line.find(',');
+    if (c1 == string::npos) return false;
+    string first = line.substr(0, c1);
+    int y = 0, m = 1, d = 1, h = 0, mi = 0, s = 0;
+    const char* amountText;
+    const char* amountEnd;
+    string dateText;
+    bool isRecord = first == "INCOME" || first == "EXPENSE";
+    size_t c2 = line.find(',', c1 + 1);
+    if (isRecord)
+    {
+        size_t c3 = c2 == string::npos ? c2 : line.find(',', c2 + 1);
+        if (c3 == string::npos) return false;
+        row.label = line.substr(c1 + 1, c2 - c1 - 1);
+        amountText = line.c_str() + c2 + 1;
+        amountEnd = line.c_str() + c3;
+        dateText = line.substr(c3 + 1, line.find(',', c3 + 1) - c3 - 1);
+    }
+    else
+    {
+        row.label = c2 == string::npos ? "" : line.substr(c2 + 1);
+        amountText = line.c_str() + c1 + 1;
+        amountEnd = line.c_str() + (c2 == string::npos ? line.size() : c2);
+        dateText = first;
+    }
+    // The whole field must be the number ("12.5abc" is not 12.5).
+    char* end;
+    double amt = strtod(amountText, &end);
+    while (end < amountEnd && (*end == ' ' || *end == '\t' || *end == '\r')) end++;
+    if (end == amountText || end != amountEnd || !isfinite(amt)) return false;
+    if (sscanf(dateText.c_str(), "%d-%d-%d %d:%d:%d", &y, &m, &d, &h, &mi, &s) < 3) return false;
+    row.cents = (isRecord && first == "EXPENSE") ? -toCents(amt) : toCents(amt);
+    row.ts = Date(y, m, d, Time(h, mi, s)).toTimestamp();
+    return true;
+}
+
+// Sorts slices on separate threads, then merges them pairwise.
+template <typename T>
+void parallelSort(vector<T>& rows)
+{
+    size_t workers = rows.size() >= 100000 ? max(1u, thread::hardware_concurrency()) : 1;
+    vector<size_t> bounds;
+    for (size_t w = 0; w <= workers; ++w) bounds.push_back(rows.size() * w / workers);
+    vector<thread> pool;
+    for (size_t w = 0; w < workers; ++w)
+        pool.emplace_back([&rows, &bounds, w]() { sort(rows.begin() + bounds[w], rows.begin() + bounds[w + 1]); });
+    for (auto& t : pool) t.join();
+    for (size_t width = 1; width < workers; width *= 2)
+    {
+        for (size_t w = 0; w + width < workers; w += 2 * width)
+        {
+            size_t last = min(w + 2 * width, workers);
+            inplace_merge(rows.begin() + bounds[w], rows.begin() + bounds[w + width], rows.begin() + bounds[last]);
+        }
+    }
+}
+
+// External merge sort of a statement by (timestamp, amount). Lines are read
+// in chunks; each chunk is parsed and sorted by several threads, each
+// writing its own run file, and next() merges the runs. Memory stays at one
+// chunk while sorting and one row per run while merging.
+class StatementSorter
+{
+private:
+    struct RunHead
+    {
+        ReconcileRow row;
+        size_t run;
+
+        bool operator>(const RunHead& other) const
+        {
+            return row > other.row;
+        }
+    };
+
+    filesystem::path dir;
+    vector<filesystem::path> runPaths;
+    vector<unique_ptr<ifstream>> runs;
+    priority_queue<RunHead, vector<RunHead>, greater<RunHead>> heads;
+
+    static bool writeRun(const filesystem::path& path, const vector<ReconcileRow>& rows)
+    {
+        ofstream out(path, ios::binary);
+        for (const auto& r : rows)
+        {
+            uint32_t len = static_cast<uint32_t>(r.label.size());
+            out.write(reinterpret_cast<const char*>(&r.ts), sizeof(r.ts));
+            out.write(reinterpret_cast<const char*>(&r.cents), sizeof(r.cents));
+            out.write(reinterpret_cast<const char*>(&r.line), sizeof(r.line));
+            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+            out.write(r.label.data(), len);
+        }
+        return out.good();
+    }
+
+    static bool readRow(istream& in, ReconcileRow& r)
+    {
+        uint32_t len;
+        if (!in.read(reinterpret_cast<char*>(&r.ts), sizeof(r.ts))) return false;
+        in.read(reinterpret_cast<char*>(&r.cents), sizeof(r.cents));
+        in.read(reinterpret_cast<char*>(&r.line), sizeof(r.line));
+        in.read(reinterpret_cast<char*>(&len), sizeof(len));
+        r.label.resize(len);
+        return static_cast<bool>(in.read(&r.label[0], len));
+    }
+
+    bool writeChunk(const vector<string>& lines, long long firstLine, size_t threads)
+    {
+        size_t workers = max<size_t>(1, min(threads, lines.size() / 10000));
+        vector<vector<ReconcileRow>> parts(workers);
+        vector<size_t> bad(workers, 0);
+        vector<char> ok(workers, 1);
+        vector<filesystem::path> paths;
+        for (size_t w = 0; w < workers; ++w) paths.push_back(dir / ("run-" + to_string(runPaths.size() + w) + ".bin"));
+        auto work = [&](size_t w)
+        {
+            size_t begin = lines.size() * w / workers;
+            size_t end = lines.size() * (w + 1) / workers;
+            for (size_t i = begin; i < end; ++i)
+            {
+                ReconcileRow row;
+                if (!parseStatementLine(lines[i], row))
+                {
+                    if (!lines[i].empty()) bad[w]++;
+                    continue;
+                }
+                row.line = firstLine + static_cast<long long>(i);
+                parts[w].push_back(move(row));
+            }
+            sort(parts[w].begin(), parts[w].end());
+            if (!parts[w].empty()) ok[w] = writeRun(paths[w], parts[w]);
+        };
+        vector<thread> pool;
+        for (size_t w = 1; w < workers; ++w) pool.emplace_back(work, w);
+        work(0);
+        for (auto& t : pool) t.join();
+
+        for (size_t w = 0; w < workers; ++w)
+        {
+            if (!ok[w]) return false;
+            invalid += bad[w];
+            if (parts[w].empty()) continue;
+            rowCount += parts[w].size();
+            minTs = min(minTs, parts[w].front().ts);
+            maxTs = max(maxTs, parts[w].back().ts);
+            runPaths.push_back(paths[w]);
+        }
+        return true;
+    }
+
+    // Sorts rows that are already parsed into one more run and empties them.
+    bool writeRows(vector<ReconcileRow>& rows)
+    {
+        if (rows.empty()) return true;
+        parallelSort(rows);
+        filesystem::path path = dir / ("run-" + to_string(runPaths.size()) + ".bin");
+        if (!writeRun(path, rows)) return false;
+        rowCount += rows.size();
+        minTs = min(minTs, rows.front().ts);
+        maxTs = max(maxTs, rows.back().ts);
+        runPaths.push_back(path);
+        rows.clear();
+        return true;
+    }
+
+    void openRuns()
+    {
+        for (size_t i = 0; i < runPaths.size(); ++i)
+        {
+            runs.emplace_back(new ifstream(runPaths[i], ios::binary));
+            RunHead head;
+            head.run = i;
+            if (readRow(*runs[i], head.row)) heads.push(move(head));
+        }
+    }
+
+public:
+    size_t rowCount = 0;
+    size_t invalid = 0;
+    long long minTs = LLONG_MAX;
+    long long maxTs = LLONG_MIN;
+
+    explicit StatementSorter(filesystem::path scratch) : dir(scratch) {}
+
+    StatementSorter(const StatementSorter&) = delete;
+    StatementSorter& operator=(const StatementSorter&) = delete;
+
+    ~StatementSorter()
+    {
+        runs.clear();
+        error_code ec;
+        filesystem::remove_all(dir, ec);
+    }
+
+    bool sortFile(const string& filename, size_t chunkRows, size_t threads)
+    {
+        ifstream file(filename);
+        error_code ec;
+        filesystem::create_directories(dir, ec);
+        if (!file.is_open() || ec) return false;
+
+        vector<string> lines;
+        lines.reserve(chunkRows);
+        long long firstLine = 1;
+        string line;
+        while (getline(file, line))
+        {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            lines.push_back(move(line));
+            if (lines.size() < chunkRows) continue;
+            if (!writeChunk(lines, firstLine, threads)) return false;
+            firstLine += static_cast<long long>(lines.size());
+            lines.clear();
+        }
+        if (!lines.empty() && !writeChunk(lines, firstLine, threads)) return false;
+        openRuns();
+        return true;
+    }
+
+    // Sorts the rows `produce` passes to its callback, spilling a run every
+    // chunkRows rows.
+    template <typename F>
+    bool sortRows(F produce, size_t chunkRows)
+    {
+        error_code ec;
+        filesystem::create_directories(dir, ec);
+        if (ec) return false;
+        vector<ReconcileRow> rows;
+        bool ok = true;
+        produce([&](ReconcileRow&& row)
+        {
+            if (!ok) return;
+            rows.push_back(move(row));
+            if (rows.size() >= chunkRows) ok = writeRows(rows);
+        });
+        if (!ok || !writeRows(rows)) return false;
+        openRuns();
+        return true;
+    }
+
+    size_t runCount() const
+    {
+        return runPaths.size();
+    }
+
+    const filesystem::path& directory() const
+    {
+        return dir;
+    }
+
+    // Rows in (timestamp, amount) order across all runs.
+    bool next(ReconcileRow& row)
+    {
+        if (heads.empty()) return false;
+        RunHead head = heads.top();
+        heads.pop();
+        row = move(head.row);
+        if (readRow(*runs[head.run], head.row)) heads.push(move(head));
+        return true;
+    }
+};
+
+struct ReconcileSummary
+{
+    size_t matched = 0;
+    size_t inexact = 0;
+    size_t missing = 0;
+    size_t extra = 0;
+    long long missingCents = 0;
+    long long extraCents = 0;
+    vector<string> missingSample;
+    vector<string> extraSample;
+    bool complete = true;
+};
+
+// Partition keys are year * 100 + month, named "YYYY-MM" on disk.
+string monthName(int key)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04d-%02d", key / 100, key % 100);
+    return buf;
+}
+
+// Copy of everything a save needs, taken on the main thread. Only dirty
+// months carry rows (found through the per-month positions), so it costs
+// the rows of the changed months plus the manifest, not O(ledger).
+struct LedgerSnapshot
+{
+    map<int, pair<vector<Income>, vector<Expense>>> months;
+    map<int, PartitionInfo> partitions;
+    string settings;
+    size_t changes = 0;
+
+    // Folds a newer snapshot into this one; newer months and manifest win.
+    void mergeNewer(LedgerSnapshot& newer)
+    {
+        for (auto& m : newer.months) months[m.first] = move(m.second);
+        partitions = move(newer.partitions);
+        settings = move(newer.settings);
+        changes += newer.changes;
+    }
+};
+
+// Background thread that serialises snapshots to temp files, fsyncs them and
+// renames them over the partition files, so saves never block the menu.
+// Deferred snapshots wait in the thread until enough changes have gathered
+// or a minute has passed, so an idle session still gets saved.
+class SnapshotWriter
+{
+private:
+    static constexpr size_t writeEveryChanges = 100;
+    static constexpr int writeEverySeconds = 60;
+
+    filesystem::path dir;
+    thread worker;
+    mutex lock;
+    condition_variable wake;
+    condition_variable idle;
+    unique_ptr<LedgerSnapshot> pending;
+    chrono::steady_clock::time_point due;
+    unique_ptr<LedgerSnapshot> failed;
+    string lastError;
+    bool busy = false;
+    bool stopping = false;
+
+    void syncDirectory() const
+    {
+#ifndef _WIN32
+        int fd = open(dir.string().c_str(), O_RDONLY);
+        if (fd < 0) return;
+        fsync(fd);
+        close(fd);
+#endif
+    }
+
+    bool write(const LedgerSnapshot& snap, string& error) const
+    {
+        error_code ec;
+        filesystem::create_directories(dir, ec);
+        if (ec)
+        {
+            error = "cannot create " + dir.string();
+            return false;
+        }
+        for (const auto& m : snap.months)
+        {
+            string name = monthName(m.first) + ".csv";
+            if (m.second.first.empty() && m.second.second.empty())
+            {
+                filesystem::remove(dir / name, ec);
+                continue;
+            }
+            ostringstream out;
+            out << setprecision(15);
+            for (const auto& inc : m.second.first) writeRecord(out, inc);
+            for (const auto& exp : m.second.second) writeRecord(out, exp);
+            if (!writeFileDurably(dir / name, out.str()))
+            {
+                error = "cannot write " + (dir / name).string();
+                return false;
+            }
+        }
+
+        ostringstream manifest;
+        manifest << setprecision(15);
+        for (const auto& p : snap.partitions)
+        {
+            // Format: PARTITION,YYYY-MM,incomes,expenses,incomeTotal,expenseTotal
+            manifest << "PARTITION," << monthName(p.first) << "," << p.second.incomeCount << "," << p.second.expenseCount
+                     << "," << p.second.incomeSum << "," << p.second.expenseSum << "\n";
+        }
+        manifest << snap.settings;
+        if (!writeFileDurably(dir / "manifest.csv", manifest.str()))
+        {
+            error = "cannot write " + (dir / "manifest.csv").string();
+            return false;
+        }
+        syncDirectory();
+        return true;
+    }
+
+    void run()
+    {
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [this] { return pending || stopping; });
+            if (!pending) break;
+            if (!stopping && pending->changes < writeEveryChanges && chrono::steady_clock::now() < due)
+            {
+                wake.wait_until(guard, due);
+                continue;
+            }
+            unique_ptr<LedgerSnapshot> snap = move(pending);
+            busy = true;
+            guard.unlock();
+            string error;
+            bool ok = write(*snap, error);
+            guard.lock();
+            busy = false;
+            if (!ok)
+            {
+                lastError = error;
+                failed = move(snap);
+            }
+            idle.notify_all();
+        }
+    }
+
+public:
+    ~SnapshotWriter()
+    {
+        stop();
+    }
+
+    void setDirectory(const filesystem::path& path)
+    {
+        dir = path;
+    }
+
+    // A deferred snapshot is written once writeEveryChanges changes are
+    // pending or writeEverySeconds after the first of them; any other is
+    // written at once (together with whatever was waiting).
+    void submit(unique_ptr<LedgerSnapshot> snap, bool deferred = false)
+    {
+        lock_guard<mutex> guard(lock);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        chrono::steady_clock::time_point writeBy = deferred ? now + chrono::seconds(writeEverySeconds) : now;
+        if (failed)
+        {
+            failed->mergeNewer(*snap);
+            snap = move(failed);
+        }
+        if (pending)
+        {
+            pending->mergeNewer(*snap);
+            due = min(due, writeBy);
+        }
+        else
+        {
+            pending = move(snap);
+            due = writeBy;
+        }
+        if (!worker.joinable()) worker = thread(&SnapshotWriter::run, this);
+        wake.notify_one();
+    }
+
+    void waitIdle()
+    {
+        unique_lock<mutex> guard(lock);
+        due = min(due, chrono::steady_clock::now());
+        wake.notify_one();
+        idle.wait(guard, [this] { return !pending && !busy; });
+    }
+
+    string takeError()
+    {
+        lock_guard<mutex> guard(lock);
+        string error;
+        error.swap(lastError);
+        return error;
+    }
+
+    void stop()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+// Exchange rates by day: rate(c, day) is what one unit of currency c is
+// worth in the base currency on the latest listed date on or before `day`
+// (the earliest listed rate before that). Each currency's rates are expanded
+// into one dense array over the listed span, so a lookup is a single index.
+class RateTable
+{
+private:
+    static const long long maxSpanDays = 200 * 366;
+
+    long long firstDay = 0;
+    size_t span = 0;
+    size_t listed = 0;
+    vector<vector<double>> byDay;
+    // Conversion factors per target currency, built on first use; a table
+    // that predates a newly interned currency is rebuilt.
+    struct Factors
+    {
+        size_t currencies = 0;
+        vector<double> table;
+    };
+    mutable map<uint16_t, Factors> factorCache;
+
+public:
+    // Lines: YYYY-MM-DD,CODE,rate  ('#' starts a comment line).
+    static bool parse(istream& in, RateTable& table, string& error)
+    {
+        map<uint16_t, map<long long, double>> points;
+        size_t count = 0;
+        string line;
+        int lineNum = 0;
+        while (getline(in, line))
+        {
+            lineNum++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            stringstream ss(line);
+            string dateText, code, rateText;
+            getline(ss, dateText, ',');
+            getline(ss, code, ',');
+            getline(ss, rateText);
+            int y, m, d;
+            code = Currency::normalize(code);
+            if (sscanf(dateText.c_str(), "%d-%d-%d", &y, &m, &d) != 3 || code.empty() || !isValidDouble(rateText) ||
+                    stod(rateText) <= 0)
+            {
+                error = "line " + to_string(lineNum) + " is not YYYY-MM-DD,CODE,rate";
+                return false;
+            }
+            points[Currency::intern(code)][Date(y, m, d).toDayNumber()] = stod(rateText);
+            count++;
+        }
+        if (points.empty())
+        {
+            error = "no rates listed";
+            return false;
+        }
+        long long lo = LLONG_MAX, hi = LLONG_MIN;
+        for (const auto& p : points)
+        {
+            lo = min(lo, p.second.begin()->first);
+            hi = max(hi, p.second.rbegin()->first);
+        }
+        if (hi - lo >= maxSpanDays)
+        {
+            error = "rates span more than 200 years";
+            return false;
+        }
+
+        RateTable t;
+        t.firstDay = lo;
+        t.span = hi - lo + 1;
+        t.listed = count;
+        t.byDay.resize(Currency::count());
+        for (const auto& p : points)
+        {
+            vector<double>& days = t.byDay[p.first];
+            days.resize(t.span);
+            auto it = p.second.begin();
+            double current = it->second;
+            for (size_t i = 0; i < t.span; ++i)
+            {
+                while (it != p.second.end() && it->first <= lo + static_cast<long long>(i)) current = (it++)->second;
+                days[i] = current;
+            }
+        }
+        table = move(t);
+        return true;
+    }
+
+    size_t days() const
+    {
+        return max<size_t>(span, 1);
+    }
+
+    size_t slot(long long day) const
+    {
+        if (span == 0 || day <= firstDay) return 0;
+        return static_cast<size_t>(min<long long>(day - firstDay, span - 1));
+    }
+
+    long long dayAt(size_t slot) const
+    {
+        return firstDay + static_cast<long long>(slot);
+    }
+
+    bool hasRates(uint16_t id) const
+    {
+        return id == 0 || (id < byDay.size() && !byDay[id].empty());
+    }
+
+    // Currencies without rates count 1:1 until rates are loaded.
+    double rate(uint16_t id, long long day) const
+    {
+        return hasRates(id) && id != 0 ? byDay[id][slot(day)] : 1;
+    }
+
+    size_t listedRates() const
+    {
+        return listed;
+    }
+
+    long long getFirstDay() const
+    {
+        return firstDay;
+    }
+
+    long long getLastDay() const
+    {
+        return firstDay + static_cast<long long>(span) - 1;
+    }
+
+    // Factors into currency `to` as a flattened [currency][day] table over
+    // days(). They are kept until the rates are replaced.
+    const vector<double>& factorsTo(uint16_t to) const
+    {
+        Factors& f = factorCache[to];
+        size_t currencies = Currency::count();
+        if (f.currencies == currencies) return f.table;
+        size_t n = days();
+        f.currencies = currencies;
+        f.table.resize(currencies * n);
+        for (size_t d = 0; d < n; ++d)
+        {
+            long long day = dayAt(d);
+            double target = rate(to, day);
+            for (size_t c = 0; c < currencies; ++c) f.table[c * n + d] = rate(static_cast<uint16_t>(c), day) / target;
+        }
+        return f.table;
+    }
+};
+
+// Sums amounts in mixed currencies into one reporting currency. Rows are
+// gathered into column buffers (amount, offset into a flattened
+// [currency][day] table of conversion factors) and each full buffer is
+// reduced by one multiply-add loop, instead of looking up rates per row.
+// The factor table is the rate table's cached one for the target currency.
+class ConversionBatch
+{
+private:
+    static const size_t width = 4096;
+
+    const RateTable& rates;
+    size_t days;
+    const vector<double>& factors;
+    double amounts[width];
+    uint32_t offsets[width];
+    size_t count = 0;
+    double total = 0;
+
+    void flush()
+    {
+        const double* f = factors.data();
+        double sum = 0;
+        for (size_t i = 0; i < count; ++i) sum += amounts[i] * f[offsets[i]];
+        total += sum;
+        count = 0;
+    }
+
+public:
+    ConversionBatch(const RateTable& r, uint16_t to) : rates(r), days(r.days()), factors(r.factorsTo(to))
+    {
+    }
+
+    void add(double amount, uint16_t currency, long long day)
+    {
+        amounts[count] = amount;
+        offsets[count] = static_cast<uint32_t>(currency * days + rates.slot(day));
+        if (++count == width) flush();
+    }
+
+    double sum()
+    {
+        flush();
+        return total;
+    }
+};
+
+enum class ExportFormat
+{
+    JSON_LINES,
+    COLUMNAR
+};
+
+// Output for exports: bytes gather in a 1 MB buffer and reach the file in
+// large writes, so an export needs the same memory at any ledger size.
+class ExportBuffer
+{
+private:
+    static const size_t capacity = 1 << 20;
+
+    ofstream out;
+    string buffer;
+    unsigned long long written = 0;
+
+public:
+    explicit ExportBuffer(const string& filename) : out(filename, ios::binary | ios::trunc)
+    {
+        buffer.reserve(capacity);
+    }
+
+    bool isOpen() const
+    {
+        return out.is_open();
+    }
+
+    void append(const char* data, size_t n)
+    {
+        if (buffer.size() + n > capacity) drain();
+        if (n >= capacity)
+        {
+            out.write(data, n);
+            written += n;
+            return;
+        }
+        buffer.append(data, n);
+    }
+
+    void append(const string& text)
+    {
+        append(text.data(), text.size());
+    }
+
+    template <typename T>
+    void appendRaw(const T& value)
+    {
+        append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void drain()
+    {
+        out.write(buffer.data(), buffer.size());
+        written += buffer.size();
+        buffer.clear();
+    }
+
+    // False if any write failed.
+    bool close()
+    {
+        drain();
+        out.close();
+        return !out.fail();
+    }
+
+    unsigned long long bytes() const
+    {
+        return written + buffer.size();
+    }
+};
+
+void appendInteger(string& out, long long value)
+{
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+// Cents as an exact decimal with two places ("-12.05").
+void appendCents(string& out, long long cents)
+{
+    unsigned long long magnitude = cents < 0 ? 0ULL - static_cast<unsigned long long>(cents) : cents;
+    if (cents < 0) out += '-';
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), magnitude / 100).ptr);
+    out += '.';
+    out += static_cast<char>('0' + magnitude % 100 / 10);
+    out += static_cast<char>('0' + magnitude % 10);
+}
+
+// ISO 8601 without a zone, like the ledger's own dates ("2026-10-19T12:00:00").
+void appendIsoTimestamp(string& out, long long ts)
+{
+    Date dt = Date::fromTimestamp(ts);
+    char text[] = "0000-00-00T00:00:00";
+    auto put = [&](int end, int width, int value)
+    {
+        for (int i = 1; i <= width; ++i, value /= 10) text[end - i] = static_cast<char>('0' + value % 10);
+    };
+    put(4, 4, dt.getYear());
+    put(7, 2, dt.getMonth());
+    put(10, 2, dt.getDay());
+    put(13, 2, dt.getTime().getHour());
+    put(16, 2, dt.getTime().getMinute());
+    put(19, 2, dt.getTime().getSecond());
+    out.append(text, 19);
+}
+
+void appendJsonString(string& out, const string& text)
+{
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (char ch : text)
+    {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += ch;
+        }
+        else if (c < 0x20)
+        {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+        else out += ch;
+    }
+    out += '"';
+}
+
+// One JSON object per line with a fixed set of keys:
+// {"type":"expense","label":"food","amount":"12.50","currency":"EUR",
+//  "timestamp":"2026-10-19T12:00:00","tags":["trip"]}
+// The amount is a decimal string so no reader rounds it through a double;
+// currency is null while no base currency has been named.
+class JsonLinesWriter
+{
+private:
+    ExportBuffer& out;
+    string line;
+
+public:
+    explicit JsonLinesWriter(ExportBuffer& o) : out(o) {}
+
+    void row(bool isIncome, const string& label, long long cents, const string& currency, long long ts, const string& tags)
+    {
+        line.assign(isIncome ? "{\"type\":\"income\",\"label\":" : "{\"type\":\"expense\",\"label\":");
+        appendJsonString(line, label);
+        line += ",\"amount\":\"";
+        appendCents(line, cents);
+        line += "\",\"currency\":";
+        if (currency.empty()) line += "null";
+        else appendJsonString(line, currency);
+        line += ",\"timestamp\":\"";
+        appendIsoTimestamp(line, ts);
+        line += "\",\"tags\":[";
+        for (size_t start = 0; start < tags.size();)
+        {
+            size_t end = tags.find(';', start);
+            if (end == string::npos) end = tags.size();
+            if (start > 0) line += ',';
+            appendJsonString(line, tags.substr(start, end - start));
+            start = end + 1;
+        }
+        line += "]}\n";
+        out.append(line);
+    }
+
+    void finish() {}
+};
+
+// Column-oriented binary export. Rows are buffered into groups of up to
+// 65536 and each group stores its columns one after another, so readers
+// can load only the columns they need. Integers are in host byte order
+// (little-endian on x86 and ARM).
+//
+//   header: "FTCOL1\0\0", uint32 column count, then per column a uint8
+//           type (1 int64, 2 uint8, 3 string) and a uint8-length name
+//   group:  uint32 rows, then per column a uint64 byte length and data;
+//           strings are uint32 end offsets (one per row) then the bytes
+//   end:    a group of 0 rows and the uint64 total row count
+//
+// Columns: timestamp (int64 seconds, local wall-clock time), type (uint8,
+// 1 income / 0 expense), amount_cents (int64), currency, label, tags
+// (';'-joined).
+class ColumnarWriter
+{
+private:
+    static const size_t groupRows = 65536;
+
+    struct StringColumn
+    {
+        vector<uint32_t> ends;
+        string bytes;
+
+        void add(const string& text)
+        {
+            bytes += text;
+            ends.push_back(static_cast<uint32_t>(bytes.size()));
+        }
+
+        void clear()
+        {
+            ends.clear();
+            bytes.clear();
+        }
+    };
+
+    ExportBuffer& out;
+    vector<int64_t> timestamps;
+    vector<uint8_t> types;
+    vector<int64_t> amounts;
+    StringColumn currencies;
+    StringColumn labels;
+    StringColumn tagColumn;
+    unsigned long long total = 0;
+
+    template <typename T>
+    void writeColumn(const vector<T>& values)
+    {
+        out.appendRaw<uint64_t>(values.size() * sizeof(T));
+        out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+    void writeColumn(const StringColumn& column)
+    {
+        out.appendRaw<uint64_t>(column.ends.size() * sizeof(uint32_t) + column.bytes.size());
+        out.append(reinterpret_cast<const char*>(column.ends.data()), column.ends.size() * sizeof(uint32_t));
+        out.append(column.bytes);
+    }
+
+    void writeGroup()
+    {
+        out.appendRaw<uint32_t>(static_cast<uint32_t>(timestamps.size()));
+        writeColumn(timestamps);
+        writeColumn(types);
+        writeColumn(amounts);
+        writeColumn(currencies);
+        writeColumn(labels);
+        writeColumn(tagColumn);
+        total += timestamps.size();
+        timestamps.clear();
+        types.clear();
+        amounts.clear();
+        currencies.clear();
+        labels.clear();
+        tagColumn.clear();
+    }
+
+public:
+    explicit ColumnarWriter(ExportBuffer& o) : out(o)
+    {
+        static const pair<uint8_t, const char*> schema[] = {{1, "timestamp"}, {2, "type"}, {1, "amount_cents"},
+            {3, "currency"}, {3, "label"}, {3, "tags"}
+        };
+        out.append("FTCOL1\0\0", 8);
+        out.appendRaw<uint32_t>(6);
+        for (const auto& column : schema)
+        {
+            out.appendRaw<uint8_t>(column.first);
+            out.appendRaw<uint8_t>(static_cast<uint8_t>(strlen(column.second)));
+            out.append(column.second, strlen(column.second));
+        }
+        timestamps.reserve(groupRows);
+        types.reserve(groupRows);
+        amounts.reserve(groupRows);
+    }
+
+    void row(bool isIncome, const string& label, long long cents, const string& currency, long long ts, const string& tags)
+    {
+        timestamps.push_back(ts);
+        types.push_back(isIncome ? 1 : 0);
+        amounts.push_back(cents);
+        currencies.add(currency);
+        labels.add(label);
+        tagColumn.add(tags);
+        if (timestamps.size() == groupRows) writeGroup();
+    }
+
+    void finish()
+    {
+        if (!timestamps.empty()) writeGroup();
+        out.appendRaw<uint32_t>(0);
+        out.appendRaw<uint64_t>(total);
+    }
+};
+
+// Projection of one budget: spend in the budget window containing each
+// future day, and the first day it passes the limit (LLONG_MAX if never).
+struct BudgetForecast
+{
+    string category;
+    string period;
+    double limit = 0;
+    double spentToDate = 0;
+    double dailyRate = 0;
+    long long windowEnd = LLONG_MAX;
+    long long overDay = LLONG_MAX;
+    vector<double> windowSpend;
+};
+
+// A cached forecast: end-of-day balances for the days after `today`. It
+// answers any horizon up to its own while the ledger version and the day
+// are unchanged.
+struct CashFlowForecast
+{
+    size_t version = 0;
+    long long today = 0;
+    int horizon = 0;
+    long long historyDays = 0;
+    double startBalance = 0;
+    double incomeRate = 0;
+    double expenseRate = 0;
+    vector<double> balance;
+    vector<BudgetForecast> budgets;
+};
+
+// One slot of a ledger vector around an edit. No value before means the
+// edit inserted at pos; no value after means it erased pos.
+template <typename T>
+struct SlotEdit
+{
+    size_t pos;
+    optional<T> before;
+    optional<T> after;
+};
+
+// The base and report currency and the rates file the rate table was parsed
+// from (null when none was loaded), as one undoable slot. Undo steps share
+// the file text instead of copying it.
+struct CurrencySettings
+{
+    string base;
+    uint16_t report = 0;
+    shared_ptr<const string> ratesText;
+};
+
+// An entry of the undo log: the slots one user action changed, in order, so
+// it costs memory in proportion to the change rather than the ledger.
+struct LedgerChange
+{
+    string description;
+    vector<SlotEdit<Income>> incomes;
+    vector<SlotEdit<Expense>> expenses;
+    vector<SlotEdit<Budget>> budgets;
+    vector<SlotEdit<RecurringRule>> rules;
+    vector<SlotEdit<CurrencySettings>> currencies;
+
+    size_t size() const
+    {
+        return incomes.size() + expenses.size() + budgets.size() + rules.size() + currencies.size();
+    }
+};
+
+class FinanceTracker
+{
+private:
+    static const size_t defaultHistoryDepth = 50;
+    static const int maxForecastDays = 3650;
+
+    friend class LedgerBenchmark;
+    friend class LedgerServer;
+
+    string dataFile;
+    filesystem::path dataDir;
+    map<int, PartitionInfo> partitions;
+    set<int> dirtyPartitions;
+    SnapshotWriter writer;
+    size_t changesSinceSnapshot = 0;
+    bool loadingPartition = false;
+    double unloadedIncome = 0;
+    double unloadedExpenses = 0;
+    map<int, ColdBlock> coldBlocks;
+    unique_ptr<MappedLedger> mapped;
+    vector<RecurringRule> rules;
+    bool settingsDirty = false;
+    vector<Income> incomes;
+    vector<Expense> expenses;
+    MonthRows incomeMonths;
+    MonthRows expenseMonths;
+    vector<Budget> budgets;
+    RateTable rates;
+    shared_ptr<const string> ratesText;
+    string baseCurrency;
+    uint16_t reportCurrency = 0;
+    CategoryTree categoryTree;
+    double totalIncome = 0;
+    double totalExpenses = 0;
+    DailyTotals dailyNet;
+    // Net of each second that has rows, per day and sorted by the second
+    // within it; the Fenwick tree answers whole days, so a balance at a
+    // time of day only walks that one day's list.
+    struct SecondNet
+    {
+        int offset;
+        double net;
+        int rows;
+    };
+    unordered_map<long long, vector<SecondNet>> intraDay;
+    unordered_map<uint64_t, uint32_t> rowHashes;
+    TagIndex incomeTags;
+    TagIndex expenseTags;
+    map<string, AmountStats> incomeStats;
+    map<string, AmountStats> expenseStats;
+    bool statsStale = false;
+    SpendingRateModel cashFlow;
+    size_t dataVersion = 0;
+    CashFlowForecast forecastCache;
+    mutable map<int, vector<size_t>> incomeOrders;
+    mutable map<int, vector<size_t>> expenseOrders;
+    deque<LedgerChange> undoHistory;
+    vector<LedgerChange> redoHistory;
+    LedgerChange pendingChange;
+    int changeDepth = 0;
+    size_t historyDepth = defaultHistoryDepth;
+
+    // Groups the edits one public operation makes into a single undo step;
+    // nested scopes (an import inside a larger action) join the outer one.
+    class ChangeScope
+    {
+    private:
+        FinanceTracker& tracker;
+
+    public:
+        ChangeScope(FinanceTracker& t, const string& description) : tracker(t)
+        {
+            if (tracker.changeDepth++ == 0) tracker.pendingChange.description = description;
+        }
+
+        ~ChangeScope()
+        {
+            if (--tracker.changeDepth == 0) tracker.commitChange();
+        }
+    };
+
+    void commitChange()
+    {
+        LedgerChange change;
+        swap(change, pendingChange);
+        if (change.size() == 0 || historyDepth == 0) return;
+        undoHistory.push_back(move(change));
+        while (undoHistory.size() > historyDepth) undoHistory.pop_front();
+        redoHistory.clear();
+    }
+
+    static int monthKey(const Date& dt)
+    {
+        return dt.getYear() * 100 + dt.getMonth();
+    }
+
+    void touchPartition(const Date& dt)
+    {
+        if (loadingPartition) return;
+        int key = monthKey(dt);
+        partitions[key].loaded = true;
+        dirtyPartitions.insert(key);
+        ++changesSinceSnapshot;
+    }
+
+    void takeSnapshot(bool deferred = false)
+    {
+        unique_ptr<LedgerSnapshot> snap(new LedgerSnapshot());
+        for (int key : dirtyPartitions)
+        {
+            auto& month = snap->months[key];
+            for (size_t pos : incomeMonths.positions(key)) month.first.push_back(incomes[pos]);
+            for (size_t pos : expenseMonths.positions(key)) month.second.push_back(expenses[pos]);
+        }
+
+        for (const auto& m : snap->months)
+        {
+            PartitionInfo info;
+            info.loaded = true;
+            info.incomeCount = m.second.first.size();
+            info.expenseCount = m.second.second.size();
+            for (const auto& inc : m.second.first) info.incomeSum += toBase(inc);
+            for (const auto& exp : m.second.second) info.expenseSum += toBase(exp);
+            if (info.incomeCount + info.expenseCount == 0) partitions.erase(m.first);
+            else partitions[m.first] = info;
+        }
+        snap->partitions = partitions;
+        ostringstream settings;
+        settings << setprecision(15);
+        writeSettings(settings);
+        if (!statsStale) writeStats(settings);
+        for (const auto& c : coldBlocks) settings << "COLD," << c.first << "\n";
+        snap->settings = settings.str();
+
+        snap->changes = changesSinceSnapshot;
+        dirtyPartitions.clear();
+        settingsDirty = false;
+        changesSinceSnapshot = 0;
+        writer.submit(move(snap), deferred);
+    }
+
+    void loadPartition(int key)
+    {
+        auto it = partitions.find(key);
+        if (it == partitions.end() || it->second.loaded) return;
+        it->second.loaded = true;
+        unloadedIncome -= it->second.incomeSum;
+        unloadedExpenses -= it->second.expenseSum;
+
+        ifstream file(dataDir / (monthName(key) + ".csv"));
+        if (!file.is_open())
+        {
+            cout << "Warning: Partition " << monthName(key) << " is missing, skipping.\n";
+            return;
+        }
+        loadingPartition = true;
+        string line;
+        int lineNum = 0;
+        while (getline(file, line)) loadRecord(line, ++lineNum);
+        loadingPartition = false;
+    }
+
+    void ensureMonthLoaded(const Date& dt)
+    {
+        loadPartition(monthKey(dt));
+    }
+
+    void ensureRangeLoaded(const Date& from, const Date& to)
+    {
+        auto first = partitions.lower_bound(monthKey(from));
+        auto last = partitions.upper_bound(monthKey(to));
+        vector<int> keys;
+        for (auto it = first; it != last; ++it)
+            if (!it->second.loaded) keys.push_back(it->first);
+        for (int key : keys) loadPartition(key);
+    }
+
+    void ensureAllLoaded()
+    {
+        vector<int> keys;
+        for (const auto& p : partitions)
+            if (!p.second.loaded) keys.push_back(p.first);
+        for (int key : keys) loadPartition(key);
+    }
+
+    // Reads the manifest and only the current month; older months load on demand.
+    void openPartitions()
+    {
+        ifstream file(dataDir / "manifest.csv");
+        string line;
+        int lineNum = 0;
+        bool sawStats = false;
+        while (getline(file, line))
+        {
+            lineNum++;
+            if (line.compare(0, 6, "STATS,") == 0)
+            {
+                sawStats = true;
+                if (!loadStats(line)) statsStale = true;
+                continue;
+            }
+            if (line.compare(0, 10, "PARTITION,") != 0)
+            {
+                loadRecord(line, lineNum);
+                continue;
+            }
+            PartitionInfo info;
+            int y = 0, m = 0;
+            if (sscanf(line.c_str(), "PARTITION,%d-%d,%zu,%zu,%lf,%lf", &y, &m, &info.incomeCount,
+                       &info.expenseCount, &info.incomeSum, &info.expenseSum) != 6)
+            {
+                cout << "Warning: Invalid partition on line " << lineNum << ", skipping.\n";
+                continue;
+            }
+            partitions[y * 100 + m] = info;
+            unloadedIncome += info.incomeSum;
+            unloadedExpenses += info.expenseSum;
+        }
+        // Manifests written before statistics existed get them rebuilt on first use.
+        if (!sawStats && (!partitions.empty() || !coldBlocks.empty())) statsStale = true;
+        ensureMonthLoaded(getCurrentDate());
+        cout << "Loaded " << dataDir.string() << " (" << incomes.size() << " incomes, " << expenses.size()
+             << " expenses this month; " << partitions.size() << " month(s) on disk, " << budgets.size() << " budgets)\n";
+    }
+
+    // Everything that is not a transaction row (kept in the manifest when partitioned).
+    void writeSettings(ostream& out) const
+    {
+        for (const auto& b : budgets)
+        {
+            out << "BUDGET," << b.getCategory() << "," << b.getAmount();
+            if (b.getPeriod() != BudgetPeriod::ALL_TIME) out << "," << b.periodCode();
+            out << "\n";
+        }
+        for (const auto& r : rules) r.writeRecord(out);
+        if (historyDepth != defaultHistoryDepth) out << "HISTORY," << historyDepth << "\n";
+        if (!baseCurrency.empty()) out << "CURRENCY,BASE," << baseCurrency << "\n";
+        if (reportCurrency != 0) out << "CURRENCY,REPORT," << Currency::code(reportCurrency) << "\n";
+    }
+
+    // Format: STATS,INCOME|EXPENSE,label,count,mean,m2,zero|bucket:count;...
+    // The empty label holds the figures over all incomes or all expenses.
+    void writeStats(ostream& out) const
+    {
+        for (const auto& s : incomeStats)
+        {
+            out << "STATS,INCOME," << s.first << ",";
+            s.second.write(out);
+            out << "\n";
+        }
+        for (const auto& s : expenseStats)
+        {
+            out << "STATS,EXPENSE," << s.first << ",";
+            s.second.write(out);
+            out << "\n";
+        }
+    }
+
+    bool loadStats(const string& line)
+    {
+        size_t c1 = line.find(',');
+        size_t c2 = line.find(',', c1 + 1);
+        size_t c3 = c2 == string::npos ? c2 : line.find(',', c2 + 1);
+        if (c3 == string::npos) return false;
+        string type = line.substr(c1 + 1, c2 - c1 - 1);
+        AmountStats stats;
+        if ((type != "INCOME" && type != "EXPENSE") || !AmountStats::parse(line.substr(c3 + 1), stats)) return false;
+        (type == "INCOME" ? incomeStats : expenseStats)[line.substr(c2 + 1, c3 - c2 - 1)] = stats;
+        return true;
+    }
+
+    void loadRecord(const string& line, int lineNum)
+    {
+        if (line.empty()) return;
+
+        stringstream ss(line);
+        string type, field1, field2, field3;
+
+        getline(ss, type, ',');
+        getline(ss, field1, ',');
+        getline(ss, field2, ',');
+        getline(ss, field3);
+
+        if (type.empty() || field1.empty()) return;
+
+        if (type == "RULE")
+        {
+            // Format: RULE,INCOME|EXPENSE,label,amount,cadence,interval,start,end
+            stringstream rest(field3);
+            string amountText, cadenceText, intervalText, startText, endText;
+            getline(rest, amountText, ',');
+            getline(rest, cadenceText, ',');
+            getline(rest, intervalText, ',');
+            getline(rest, startText, ',');
+            getline(rest, endText);
+            Cadence cadence;
+            if ((field1 != "INCOME" && field1 != "EXPENSE") || field2.empty() || !isValidDouble(amountText) ||
+                    !RecurringRule::parseCadence(cadenceText, cadence) || !isValidInt(intervalText))
+            {
+                cout << "Warning: Invalid recurring rule on line " << lineNum << ", skipping.\n";
+                return;
+            }
+            int y = 2000, m = 1, d = 1, h = 0, min = 0, sec = 0;
+            sscanf(startText.c_str(), "%d-%d-%d %d:%d:%d", &y, &m, &d, &h, &min, &sec);
+            Date first(y, m, d, Time(h, min, sec));
+            y = 9999, m = 12, d = 31, h = 23, min = 59, sec = 59;
+            sscanf(endText.c_str(), "%d-%d-%d %d:%d:%d", &y, &m, &d, &h, &min, &sec);
+            Date last(y, m, d, Time(h, min, sec));
+            string label = field1 == "EXPENSE" ? normalizeCategory(field2) : field2;
+            rules.push_back(RecurringRule(field1 == "INCOME", label, stod(amountText), cadence, stoi(intervalText), first, last));
+        }
+        else if (type == "CURRENCY")
+        {
+            // Format: CURRENCY,BASE|REPORT,code
+            string code = Currency::normalize(field2);
+            if (code.empty() || (field1 != "BASE" && field1 != "REPORT"))
+                cout << "Warning: Invalid currency setting on line " << lineNum << ", skipping.\n";
+            else if (field1 == "BASE") baseCurrency = code;
+            else reportCurrency = code == baseCurrency ? 0 : Currency::intern(code);
+        }
+        else if (type == "HISTORY")
+        {
+            // Format: HISTORY,depth  (number of undo steps kept)
+            if (isValidInt(field1) && stoi(field1) >= 0) historyDepth = stoi(field1);
+            else cout << "Warning: Invalid history depth on line " << lineNum << ", skipping.\n";
+        }
+        else if (type == "COLD")
+        {
+            // Format: COLD,year  (rows live in cold-<year>.bin next to the manifest)
+            loadColdBlock(field1, lineNum);
+        }
+        else if (type == "BUDGET")
+        {
+            // Format: BUDGET,category,amount[,MONTHLY|WEEKLY|ROLLING:days]
+            try
+            {
+                double amt = stod(field2);
+                BudgetPeriod period;
+                int rollingDays;
+                if (!Budget::parsePeriodCode(field3, period, rollingDays))
+                {
+                    cout << "Warning: Invalid budget period on line " << lineNum << ", skipping.\n";
+                    return;
+                }
+                budgets.push_back(Budget(normalizeCategory(field1), amt, period, rollingDays));
+            }
+            catch (...)
+            {
+                cout << "Warning: Invalid budget on line " << lineNum << ", skipping.\n";
+            }
+        }
+        else if (type == "INCOME" || type == "EXPENSE")
+        {
+            // Format: INCOME,source,amount,date[,tag;tag...[,currency]]
+            // Format: EXPENSE,category,amount,date[,tag;tag...[,currency]]
+            double amt;
+            Date dt;
+            size_t comma = field3.find(',');
+            if (!parseTransactionFields(field2, field3.substr(0, comma), amt, dt))
+            {
+                cout << "Warning: Invalid transaction on line " << lineNum << ", skipping.\n";
+                return;
+            }
+            vector<string> tags;
+            uint16_t currency = 0;
+            if (comma != string::npos) parseRecordExtras(field3.substr(comma + 1), tags, currency);
+
+            if (type == "INCOME")
+            {
+                Income inc(field1, amt, dt);
+                inc.setTags(tags);
+                inc.setCurrency(currency);
+                appendIncome(inc);
+            }
+            else if (type == "EXPENSE")
+            {
+                string category = normalizeCategory(field1);
+                if (category.empty())
+                {
+                    cout << "Warning: Invalid category on line " << lineNum << ", skipping.\n";
+                    return;
+                }
+                Expense exp(category, amt, dt);
+                exp.setTags(tags);
+                exp.setCurrency(currency);
+                appendExpense(exp);
+            }
+        }
+    }
+
+    // Reports nothing itself: loads warn per line, imports only count.
+    static bool parseTransactionFields(const string& amountText, const string& dateText, double& amt, Date& dt)
+    {
+        size_t used = 0;
+        try
+        {
+            amt = stod(amountText, &used);
+        }
+        catch (...)
+        {
+        }
+        if (used == 0 || amountText.find_first_not_of(" \t", used) != string::npos || !isfinite(amt)) return false;
+
+        // format is "YYYY-MM-DD HH:MM:SS" (the time may be left out)
+        int y = 0, m = 0, d = 0, h = 0, min = 0, sec = 0;
+        int fields = sscanf(dateText.c_str(), "%d-%d-%d %d:%d:%d", &y, &m, &d, &h, &min, &sec);
+        if ((fields != 3 && fields != 6) || y < 1900 || y > 9999 || m < 1 || m > 12 || d < 1 || d > Date::daysInMonth(y, m) ||
+                h < 0 || h > 23 || min < 0 || min > 59 || sec < 0 || sec > 59)
+            return false;
+        dt = Date(y, m, d, Time(h, min, sec));
+        return true;
+    }
+
+    static filesystem::path coldBlockPath(const filesystem::path& dir, int year)
+    {
+        return dir / ("cold-" + to_string(year) + ".bin");
+    }
+
+    void loadColdBlock(const string& yearText, int lineNum)
+    {
+        if (!isValidInt(yearText) || dataDir.empty())
+        {
+            cout << "Warning: Invalid archive entry on line " << lineNum << ", skipping.\n";
+            return;
+        }
+        int year = stoi(yearText);
+        ifstream file(coldBlockPath(dataDir, year), ios::binary);
+        if (!file.is_open())
+        {
+            cout << "Warning: Archive for " << year << " is missing, skipping.\n";
+            return;
+        }
+        stringstream bytes;
+        bytes << file.rdbuf();
+        try
+        {
+            coldBlocks[year] = ColdBlock::parse(bytes.str());
+            coldBlocks[year].forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+            {
+                countRowHash(isIncome, label, cents, 0, ts, 1);
+            });
+        }
+        catch (const exception& e)
+        {
+            cout << "Warning: Archive for " << year << " is damaged (" << e.what() << "), skipping.\n";
+        }
+    }
+
+    // Sum of matching rule occurrences in [fromTs, toTs]; label == nullptr matches all.
+    double recurringTotal(bool income, const string* label, long long fromTs, long long toTs) const
+    {
+        double total = 0;
+        for (const auto& r : rules)
+        {
+            if (r.isIncome() == income && (!label || inCategory(r.getLabel(), *label))) total += r.totalBetween(fromTs, toTs);
+        }
+        return total;
+    }
+
+    static long long nowTimestamp()
+    {
+        return getCurrentDate().toTimestamp();
+    }
+
+    static Income archivedIncome(const string& label, long long cents, long long ts, const string& tags = "")
+    {
+        Income inc(label, cents / 100.0, Date::fromTimestamp(ts));
+        if (!tags.empty()) inc.setTags(parseTagList(tags));
+        return inc;
+    }
+
+    static Expense archivedExpense(const string& label, long long cents, long long ts, const string& tags = "")
+    {
+        Expense exp(label, cents / 100.0, Date::fromTimestamp(ts));
+        if (!tags.empty()) exp.setTags(parseTagList(tags));
+        return exp;
+    }
+
+    size_t archivedRowCount() const
+    {
+        size_t count = 0;
+        for (const auto& c : coldBlocks) count += c.second.rowCount();
+        return count;
+    }
+
+    void indexNet(const Date& dt, double amt, int sign)
+    {
+        long long day = dt.toDayNumber();
+        dailyNet.add(day, amt);
+        int offset = static_cast<int>(dt.toTimestamp() - day * 86400);
+        vector<SecondNet>& entries = intraDay[day];
+        auto it = lower_bound(entries.begin(), entries.end(), offset,
+                              [](const SecondNet& e, int o) { return e.offset < o; });
+        if (it == entries.end() || it->offset != offset) it = entries.insert(it, {offset, 0, 0});
+        it->net += amt;
+        it->rows += sign;
+        // Dropped with its last row, so deletes and undo leave nothing behind.
+        if (it->rows > 0) return;
+        entries.erase(it);
+        if (entries.empty()) intraDay.erase(day);
+    }
+
+    void countRowHash(bool isIncome, const string& label, long long cents, uint16_t currency, long long ts, int sign)
+    {
+        uint64_t h = rowFingerprint(isIncome, label, cents, currency, ts);
+        if (sign > 0)
+        {
+            ++rowHashes[h];
+            return;
+        }
+        auto it = rowHashes.find(h);
+        if (it != rowHashes.end() && --it->second == 0) rowHashes.erase(it);
+    }
+
+    size_t countMatching(bool isIncome, const string& label, double amt, uint16_t currency, const Date& dt) const
+    {
+        auto it = rowHashes.find(rowFingerprint(isIncome, label, toCents(amt), currency, dt.toTimestamp()));
+        return it == rowHashes.end() ? 0 : it->second;
+    }
+
+    // Rows are always indexed in place in their vector, so the position is
+    // the row's offset in it.
+    template <typename T>
+    static void indexTags(const vector<T>& rows, TagIndex& index, const T& row, int sign)
+    {
+        if (row.getTags().empty()) return;
+        size_t pos = static_cast<size_t>(&row - rows.data());
+        if (sign > 0) index.add(pos, row.getTags());
+        else index.remove(pos, row.getTags());
+    }
+
+    // Keeps the running statistics current. An expense counts toward its
+    // category and every ancestor; the empty label collects everything.
+    // Partition loads are skipped because the persisted statistics already
+    // cover rows on disk.
+    void trackAmount(bool isIncome, const string& label, double amt, int sign)
+    {
+        if (loadingPartition || statsStale) return;
+        map<string, AmountStats>& stats = isIncome ? incomeStats : expenseStats;
+        vector<string> keys{"", label};
+        if (!isIncome)
+        {
+            for (size_t slash = label.find('/'); slash != string::npos; slash = label.find('/', slash + 1))
+                keys.push_back(label.substr(0, slash));
+        }
+        for (const auto& key : keys)
+        {
+            if (sign > 0)
+            {
+                stats[key].add(amt);
+                continue;
+            }
+            auto it = stats.find(key);
+            if (it == stats.end()) continue;
+            it->second.remove(amt);
+            if (it->second.getCount() == 0) stats.erase(it);
+        }
+    }
+
+    // Rebuilds the statistics from every row (hot, on disk and archived).
+    void refreshStats()
+    {
+        if (!statsStale) return;
+        ensureAllLoaded();
+        statsStale = false;
+        incomeStats.clear();
+        expenseStats.clear();
+        for (const auto& inc : incomes) trackAmount(true, inc.getSource(), toBase(inc), 1);
+        for (const auto& exp : expenses) trackAmount(false, exp.getCategory(), toBase(exp), 1);
+        for (const auto& c : coldBlocks)
+        {
+            c.second.forEachRow([&](bool isIncome, const string& label, long long cents, long long)
+            {
+                trackAmount(isIncome, label, cents / 100.0, 1);
+            });
+        }
+        settingsDirty = true;
+    }
+
+    // What a new amount is judged against: the label's own statistics, else
+    // its closest ancestor category with enough history, else the overall ones.
+    const AmountStats* statsFor(bool isIncome, string label)
+    {
+        refreshStats();
+        const map<string, AmountStats>& stats = isIncome ? incomeStats : expenseStats;
+        while (true)
+        {
+            auto it = stats.find(label);
+            if (it != stats.end() && it->second.getCount() >= AmountStats::minSamples) return &it->second;
+            if (label.empty()) return nullptr;
+            size_t slash = isIncome ? string::npos : label.rfind('/');
+            label = slash == string::npos ? "" : label.substr(0, slash);
+        }
+    }
+
+    // Amounts in the hot indexes, partition sums, archives and statistics are
+    // all in the base currency, converted at the rate of the row's day.
+    double toBase(const Transaction& t) const
+    {
+        return t.getCurrency() == 0 ? t.getAmount() : t.getAmount() * rates.rate(t.getCurrency(), t.getDate().toDayNumber());
+    }
+
+    static long long dayOf(long long ts)
+    {
+        return ts >= 0 ? ts / 86400 : (ts - 86399) / 86400;
+    }
+
+    // Reads a currency the user typed; the base currency's own code maps to 0.
+    bool resolveCurrency(const string& text, uint16_t& id)
+    {
+        id = 0;
+        if (text.empty()) return true;
+        string code = Currency::normalize(text);
+        if (code.empty()) return false;
+        if (code == baseCurrency) return true;
+        id = Currency::intern(code);
+        if (!rates.hasRates(id)) cout << "Warning: No exchange rates for " << code << " yet; it counts 1:1 until rates are loaded.\n";
+        return true;
+    }
+
+    string currencyName(uint16_t id) const
+    {
+        if (id != 0) return Currency::code(id);
+        return baseCurrency.empty() ? "base currency" : baseCurrency;
+    }
+
+    // Income and expense totals in currency `to` over [fromTs, toTs], with
+    // expenses limited to `category` (and incomes skipped) when given. Hot
+    // rows convert from their own currency; archived, mapped and recurring
+    // amounts are already in the base currency.
+    pair<double, double> convertedTotals(uint16_t to, const string* category, long long fromTs, long long toTs)
+    {
+        ConversionBatch income(rates, to), spent(rates, to);
+        if (!category)
+        {
+            for (const auto& inc : incomes)
+            {
+                long long ts = inc.getDate().toTimestamp();
+                if (ts >= fromTs && ts <= toTs) income.add(inc.getAmount(), inc.getCurrency(), dayOf(ts));
+            }
+        }
+        for (const auto& exp : expenses)
+        {
+            if (category && !inCategory(exp.getCategory(), *category)) continue;
+            long long ts = exp.getDate().toTimestamp();
+            if (ts >= fromTs && ts <= toTs) spent.add(exp.getAmount(), exp.getCurrency(), dayOf(ts));
+        }
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.overlaps(fromTs, toTs)) continue;
+            c.second.forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+            {
+                if (ts < fromTs || ts > toTs || (category && (isIncome || !inCategory(label, *category)))) return;
+                (isIncome ? income : spent).add(cents / 100.0, 0, dayOf(ts));
+            });
+        }
+        if (mapped)
+        {
+            mapped->scanRange(fromTs, toTs, [&](const MappedLedger::Row& r)
+            {
+                if (category && (r.isIncome || !inCategory(MappedLedger::labelOf(r), *category))) return;
+                (r.isIncome ? income : spent).add(r.cents / 100.0, 0, dayOf(r.ts));
+            });
+        }
+        for (const auto& r : rules)
+        {
+            if (category && (r.isIncome() || !inCategory(r.getLabel(), *category))) continue;
+            ConversionBatch& target = r.isIncome() ? income : spent;
+            r.forEachOccurrence(fromTs, min(toTs, nowTimestamp()), [&](long long ts) { target.add(r.getAmount(), 0, dayOf(ts)); });
+        }
+        return make_pair(income.sum(), spent.sum());
+    }
+
+    template <typename T>
+    static void indexMonth(const vector<T>& rows, MonthRows& index, const T& row, int sign)
+    {
+        size_t pos = static_cast<size_t>(&row - rows.data());
+        if (sign > 0) index.add(monthKey(row.getDate()), pos);
+        else index.remove(monthKey(row.getDate()), pos);
+    }
+
+    void indexIncome(const Income& inc, int sign = 1)
+    {
+        indexTags(incomes, incomeTags, inc, sign);
+        indexMonth(incomes, incomeMonths, inc, sign);
+        trackAmount(true, inc.getSource(), toBase(inc), sign);
+        double amt = sign * toBase(inc);
+        cashFlow.add(true, inc.getSource(), inc.getDate().toDayNumber(), amt, sign);
+        ++dataVersion;
+        touchPartition(inc.getDate());
+        countRowHash(true, inc.getSource(), toCents(inc.getAmount()), inc.getCurrency(), inc.getDate().toTimestamp(), sign);
+        incomeOrders.clear();
+        totalIncome += amt;
+        indexNet(inc.getDate(), amt, sign);
+    }
+
+    void unindexIncome(const Income& inc)
+    {
+        indexIncome(inc, -1);
+    }
+
+    void indexExpense(const Expense& exp, int sign = 1)
+    {
+        indexTags(expenses, expenseTags, exp, sign);
+        indexMonth(expenses, expenseMonths, exp, sign);
+        trackAmount(false, exp.getCategory(), toBase(exp), sign);
+        double amt = sign * toBase(exp);
+        cashFlow.add(false, exp.getCategory(), exp.getDate().toDayNumber(), amt, sign);
+        ++dataVersion;
+        touchPartition(exp.getDate());
+        countRowHash(false, exp.getCategory(), toCents(exp.getAmount()), exp.getCurrency(), exp.getDate().toTimestamp(), sign);
+        expenseOrders.clear();
+        totalExpenses += amt;
+        categoryTree.add(exp.getCategory(), exp.getDate().toDayNumber(), amt);
+        indexNet(exp.getDate(), -amt, sign);
+    }
+
+    void unindexExpense(const Expense& exp)
+    {
+        indexExpense(exp, -1);
+    }
+
+    // Slot edits behind every mutation and behind undo/redo. With `exists`
+    // the row at pos is replaced by value, or erased when value is empty;
+    // otherwise value is inserted at pos. The index hooks see the old and
+    // new row, and an open ChangeScope logs the edit.
+    void writeIncome(size_t pos, bool exists, const optional<Income>& value)
+    {
+        optional<Income> before;
+        if (exists)
+        {
+            before = incomes[pos];
+            unindexIncome(incomes[pos]);
+        }
+        if (exists && value) incomes[pos] = *value;
+        else if (value)
+        {
+            incomes.insert(incomes.begin() + pos, *value);
+            incomeMonths.shift(pos, 1);
+            incomeTags.shift(pos, 1);
+        }
+        else if (exists)
+        {
+            incomes.erase(incomes.begin() + pos);
+            incomeMonths.shift(pos, -1);
+            incomeTags.shift(pos, -1);
+        }
+        if (value) indexIncome(incomes[pos]);
+        if (changeDepth > 0) pendingChange.incomes.push_back({pos, move(before), value});
+    }
+
+    void writeExpense(size_t pos, bool exists, const optional<Expense>& value)
+    {
+        optional<Expense> before;
+        if (exists)
+        {
+            before = expenses[pos];
+            unindexExpense(expenses[pos]);
+        }
+        if (exists && value) expenses[pos] = *value;
+        else if (value)
+        {
+            expenses.insert(expenses.begin() + pos, *value);
+            expenseMonths.shift(pos, 1);
+            expenseTags.shift(pos, 1);
+        }
+        else if (exists)
+        {
+            expenses.erase(expenses.begin() + pos);
+            expenseMonths.shift(pos, -1);
+            expenseTags.shift(pos, -1);
+        }
+        if (value) indexExpense(expenses[pos]);
+        if (changeDepth > 0) pendingChange.expenses.push_back({pos, move(before), value});
+    }
+
+    // Same for budgets and recurring rules, which only need saving (value
+    // is spelled through the vector type so callers can pass a plain T).
+    template <typename T>
+    void writeSetting(vector<T>& items, vector<SlotEdit<T>>& log, size_t pos, bool exists,
+                      const optional<typename vector<T>::value_type>& value)
+    {
+        optional<T> before;
+        if (exists) before = items[pos];
+        if (exists && value) items[pos] = *value;
+        else if (value) items.insert(items.begin() + pos, *value);
+        else if (exists) items.erase(items.begin() + pos);
+        settingsDirty = true;
+        ++dataVersion;
+        if (changeDepth > 0) log.push_back({pos, move(before), value});
+    }
+
+    // Redo replays a step's edits in order; undo replays their inverses
+    // (after -> before) newest first.
+    template <typename T, typename Write>
+    static void replay(const vector<SlotEdit<T>>& edits, bool forward, Write write)
+    {
+        if (forward)
+        {
+            for (const auto& e : edits) write(e.pos, e.before.has_value(), e.after);
+            return;
+        }
+        for (auto it = edits.rbegin(); it != edits.rend(); ++it) write(it->pos, it->after.has_value(), it->before);
+    }
+
+    void applyChange(const LedgerChange& change, bool forward)
+    {
+        replay(change.incomes, forward, [&](size_t pos, bool exists, const optional<Income>& v) { writeIncome(pos, exists, v); });
+        replay(change.expenses, forward, [&](size_t pos, bool exists, const optional<Expense>& v) { writeExpense(pos, exists, v); });
+        replay(change.budgets, forward, [&](size_t pos, bool exists, const optional<Budget>& v)
+        {
+            writeSetting(budgets, pendingChange.budgets, pos, exists, v);
+        });
+        replay(change.rules, forward, [&](size_t pos, bool exists, const optional<RecurringRule>& v)
+        {
+            writeSetting(rules, pendingChange.rules, pos, exists, v);
+        });
+        replay(change.currencies, forward, [&](size_t, bool, const optional<CurrencySettings>& v) { writeCurrencies(*v); });
+    }
+
+    // Installs currency settings, logging the edit in an open ChangeScope.
+    // A different rates file is saved first (nothing changes if that fails)
+    // and the foreign-currency rows are re-valued at its rates; `parsed`
+    // spares parsing a file the caller already read.
+    bool writeCurrencies(const CurrencySettings& value, RateTable* parsed = nullptr)
+    {
+        CurrencySettings before{baseCurrency, reportCurrency, ratesText};
+        if (value.ratesText != ratesText)
+        {
+            RateTable loaded;
+            if (parsed) loaded = move(*parsed);
+            else if (value.ratesText)
+            {
+                stringstream in(*value.ratesText);
+                string error;
+                RateTable::parse(in, loaded, error);
+            }
+            if (!dataDir.empty())
+            {
+                error_code ec;
+                filesystem::create_directories(dataDir, ec);
+                bool saved = value.ratesText ? writeFileDurably(dataDir / "rates.csv", *value.ratesText)
+                                             : filesystem::remove(dataDir / "rates.csv", ec) || !ec;
+                if (!saved)
+                {
+                    cout << "Error: Could not save the rates!\n";
+                    return false;
+                }
+            }
+            ensureAllLoaded();
+            for (const auto& inc : incomes)
+                if (inc.getCurrency() != 0) unindexIncome(inc);
+            for (const auto& exp : expenses)
+                if (exp.getCurrency() != 0) unindexExpense(exp);
+            rates = move(loaded);
+            ratesText = value.ratesText;
+            for (const auto& inc : incomes)
+                if (inc.getCurrency() != 0) indexIncome(inc);
+            for (const auto& exp : expenses)
+                if (exp.getCurrency() != 0) indexExpense(exp);
+        }
+        baseCurrency = value.base;
+        reportCurrency = value.report;
+        settingsDirty = true;
+        if (changeDepth > 0) pendingChange.currencies.push_back({0, move(before), value});
+        return true;
+    }
+
+    // Months still on disk contribute their manifest totals.
+    // Archived years contribute their block totals, recurring rules their
+    // occurrences up to now.
+    double calculateTotalIncome() const
+    {
+        long long cold = 0;
+        for (const auto& c : coldBlocks) cold += c.second.getIncomeCents();
+        if (mapped) cold += mapped->getIncomeCents();
+        return totalIncome + unloadedIncome + cold / 100.0 + recurringTotal(true, nullptr, LLONG_MIN, nowTimestamp());
+    }
+
+    double calculateTotalExpenses() const
+    {
+        long long cold = 0;
+        for (const auto& c : coldBlocks) cold += c.second.getExpenseCents();
+        if (mapped) cold += mapped->getExpenseCents();
+        return totalExpenses + unloadedExpenses + cold / 100.0 + recurringTotal(false, nullptr, LLONG_MIN, nowTimestamp());
+    }
+
+    // One pass over a transaction vector that counts, sums and optionally
+    // collects matching positions; large inputs are split across threads.
+    // Amounts are compared and summed in the base currency.
+    template <typename T>
+    void scanFiltered(const vector<T>& rows, bool isIncome, const TransactionFilter& filter,
+                      bool collectRows, bool parallel, size_t& count, double& sum, vector<size_t>& matched) const
+    {
+        if (rows.empty() || filter.matchesNothing(isIncome)) return;
+        size_t workers = 1;
+        if (parallel && rows.size() >= 100000) workers = max(1u, thread::hardware_concurrency());
+
+        vector<size_t> counts(workers, 0);
+        vector<double> sums(workers, 0);
+        vector<vector<size_t>> hits(workers);
+        auto work = [&](size_t w)
+        {
+            size_t begin = rows.size() * w / workers;
+            size_t end = rows.size() * (w + 1) / workers;
+            FilterRow row;
+            row.isIncome = isIncome;
+            size_t c = 0;
+            double s = 0;
+            for (size_t i = begin; i < end; ++i)
+            {
+                row.amount = toBase(rows[i]);
+                row.label = &transactionLabel(rows[i]);
+                row.date = &rows[i].getDate();
+                row.hasTimestamp = false;
+                if (!filter.matches(row)) continue;
+                ++c;
+                s += row.amount;
+                if (collectRows) hits[w].push_back(i);
+            }
+            counts[w] = c;
+            sums[w] = s;
+        };
+
+        vector<thread> pool;
+        for (size_t w = 1; w < workers; ++w) pool.emplace_back(work, w);
+        work(0);
+        for (auto& t : pool) t.join();
+
+        for (size_t w = 0; w < workers; ++w)
+        {
+            count += counts[w];
+            sum += sums[w];
+            matched.insert(matched.end(), hits[w].begin(), hits[w].end());
+        }
+    }
+
+    template <typename T>
+    bool rowBefore(const vector<T>& rows, size_t a, size_t b, SortKey key, bool descending) const
+    {
+        const T& x = rows[descending ? b : a];
+        const T& y = rows[descending ? a : b];
+        int c = compareKeys(toBase(x), x.getDate().toTimestamp(), transactionLabel(x),
+                            toBase(y), y.getDate().toTimestamp(), transactionLabel(y), key);
+        return c != 0 ? c < 0 : a < b;
+    }
+
+    // Ascending order of two rows by one sort key: negative, zero or positive.
+    static int compareKeys(double amountA, long long tsA, const string& labelA, double amountB, long long tsB,
+                           const string& labelB, SortKey key)
+    {
+        if (key == SortKey::AMOUNT) return amountA < amountB ? -1 : (amountB < amountA ? 1 : 0);
+        if (key == SortKey::DATE) return tsA < tsB ? -1 : (tsB < tsA ? 1 : 0);
+        return labelA.compare(labelB);
+    }
+
+    // Calls visit(label, amount, timestamp, tags, recurring) for every
+    // income (or expense) in [fromTs, toTs] that has no hot slot: rows of
+    // archived years and of a mapped ledger, in base-currency amounts, and
+    // recurring occurrences up to now (as the balances count them).
+    template <typename F>
+    void forEachDetachedRow(bool isIncome, long long fromTs, long long toTs, F visit) const
+    {
+        static const string untagged;
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.overlaps(fromTs, toTs)) continue;
+            c.second.forEachTaggedRow([&](bool income, const string& label, long long cents, long long ts, const string& tags)
+            {
+                if (income == isIncome && ts >= fromTs && ts <= toTs) visit(label, cents / 100.0, ts, tags, false);
+            });
+        }
+        if (mapped)
+        {
+            mapped->scanRange(fromTs, toTs, [&](const MappedLedger::Row& r)
+            {
+                if ((r.isIncome != 0) == isIncome) visit(MappedLedger::labelOf(r), r.cents / 100.0, r.ts, untagged, false);
+            });
+        }
+        for (const auto& r : rules)
+        {
+            if (r.isIncome() != isIncome) continue;
+            r.forEachOccurrence(fromTs, min(toTs, nowTimestamp()), [&](long long ts)
+            {
+                visit(r.getLabel(), r.getAmount(), ts, untagged, true);
+            });
+        }
+    }
+
+    // Counts and sums the detached rows a filter matches, keeping them for
+    // listing when asked.
+    void scanDetached(const TransactionFilter& filter, bool collectRows, FilterScanResult& result) const
+    {
+        long long fromTs, toTs;
+        filter.timeBounds(fromTs, toTs);
+        for (int t = 0; t < 2; ++t)
+        {
+            bool isIncome = t == 1;
+            if (filter.matchesNothing(isIncome)) continue;
+            FilterRow row;
+            row.isIncome = isIncome;
+            row.date = nullptr;
+            row.hasTimestamp = true;
+            forEachDetachedRow(isIncome, fromTs, toTs, [&](const string& label, double amount, long long ts, const string& tags, bool recurring)
+            {
+                row.amount = amount;
+                row.label = &label;
+                row.timestamp = ts;
+                if (!filter.matches(row)) return;
+                (isIncome ? result.incomeCount : result.expenseCount)++;
+                (isIncome ? result.incomeSum : result.expenseSum) += amount;
+                (recurring ? result.recurringCount : result.archivedCount)++;
+                if (collectRows) (isIncome ? result.archivedIncomes : result.archivedExpenses).push_back({label, amount, ts, tags, recurring});
+            });
+        }
+    }
+
+    // The first `limit` detached rows in the requested order (kept in a
+    // bounded heap, so memory follows the page, not the archive) and the
+    // number that passed the filter.
+    vector<DetachedRow> topDetachedRows(bool isIncome, const TransactionFilter* filter, SortKey key, bool descending,
+                                        size_t limit, size_t& total) const
+    {
+        auto before = [&](const DetachedRow& a, const DetachedRow& b)
+        {
+            int c = compareKeys(a.amount, a.ts, a.label, b.amount, b.ts, b.label, key);
+            return descending ? c > 0 : c < 0;
+        };
+        vector<DetachedRow> heap;
+        total = 0;
+        long long fromTs = LLONG_MIN, toTs = LLONG_MAX;
+        if (filter) filter->timeBounds(fromTs, toTs);
+        if (filter && filter->matchesNothing(isIncome)) return heap;
+        FilterRow row;
+        row.isIncome = isIncome;
+        row.date = nullptr;
+        row.hasTimestamp = true;
+        forEachDetachedRow(isIncome, fromTs, toTs, [&](const string& label, double amount, long long ts, const string& tags, bool recurring)
+        {
+            row.amount = amount;
+            row.label = &label;
+            row.timestamp = ts;
+            if (filter && !filter->matches(row)) return;
+            total++;
+            DetachedRow candidate{label, amount, ts, tags, recurring};
+            if (heap.size() < limit)
+            {
+                heap.push_back(move(candidate));
+                push_heap(heap.begin(), heap.end(), before);
+            }
+            else if (limit > 0 && before(candidate, heap.front()))
+            {
+                pop_heap(heap.begin(), heap.end(), before);
+                heap.back() = move(candidate);
+                push_heap(heap.begin(), heap.end(), before);
+            }
+        });
+        sort_heap(heap.begin(), heap.end(), before);
+        return heap;
+    }
+
+    static void viewDetachedRow(bool isIncome, const DetachedRow& r)
+    {
+        cout << (r.recurring ? "(recurring) " : "archived: ");
+        if (isIncome) archivedIncome(r.label, toCents(r.amount), r.ts, r.tags).viewTrans();
+        else archivedExpense(r.label, toCents(r.amount), r.ts, r.tags).viewTrans();
+    }
+
+    // Positions [begin, end) of the requested ordering. Short prefixes (top-N)
+    // use a bounded heap; anything deeper sorts once and caches the order
+    // until the next mutation so further pages are O(page size).
+    template <typename T>
+    vector<size_t> orderedSlice(const vector<T>& rows, const vector<size_t>* candidates,
+                                map<int, vector<size_t>>& cache, SortKey key, bool descending,
+                                size_t begin, size_t end) const
+    {
+        auto before = [&](size_t a, size_t b)
+        {
+            return rowBefore(rows, a, b, key, descending);
+        };
+        size_t total = candidates ? candidates->size() : rows.size();
+        end = min(end, total);
+        if (begin >= end) return vector<size_t>();
+
+        int cacheKey = static_cast<int>(key) * 2 + (descending ? 1 : 0);
+        if (!candidates)
+        {
+            auto cached = cache.find(cacheKey);
+            if (cached != cache.end())
+                return vector<size_t>(cached->second.begin() + begin, cached->second.begin() + end);
+        }
+
+        if (end <= total / 8)
+        {
+            priority_queue<size_t, vector<size_t>, decltype(before)> heap(before);
+            for (size_t n = 0; n < total; ++n)
+            {
+                size_t pos = candidates ? (*candidates)[n] : n;
+                if (heap.size() < end)
+                {
+                    heap.push(pos);
+                }
+                else if (before(pos, heap.top()))
+                {
+                    heap.pop();
+                    heap.push(pos);
+                }
+            }
+            vector<size_t> best(heap.size());
+            for (size_t n = best.size(); n > 0; --n)
+            {
+                best[n - 1] = heap.top();
+                heap.pop();
+            }
+            return vector<size_t>(best.begin() + begin, best.end());
+        }
+
+        vector<size_t> order;
+        if (candidates)
+        {
+            order = *candidates;
+        }
+        else
+        {
+            order.resize(total);
+            for (size_t n = 0; n < total; ++n) order[n] = n;
+        }
+        if (key == SortKey::LABEL)
+        {
+            sort(order.begin(), order.end(), before);
+        }
+        else
+        {
+            // Sort flat (key, position) pairs instead of chasing rows on every comparison.
+            vector<pair<double, size_t>> keyed(order.size());
+            for (size_t n = 0; n < order.size(); ++n)
+            {
+                const T& row = rows[order[n]];
+                double k = key == SortKey::AMOUNT ? toBase(row) : static_cast<double>(row.getDate().toTimestamp());
+                keyed[n] = make_pair(descending ? -k : k, order[n]);
+            }
+            sort(keyed.begin(), keyed.end());
+            for (size_t n = 0; n < keyed.size(); ++n) order[n] = keyed[n].second;
+        }
+        vector<size_t> slice(order.begin() + begin, order.begin() + end);
+        if (!candidates) cache[cacheKey].swap(order);
+        return slice;
+    }
+
+    // Detached rows (already the first page-worth in order) are merged with
+    // the hot ordering; on ties the hot row comes first.
+    template <typename T>
+    void viewSortedRows(const vector<T>& rows, const vector<size_t>* candidates, map<int, vector<size_t>>& cache,
+                        const string& title, const string& labelName, SortKey key, bool descending,
+                        size_t page, size_t pageSize, const vector<DetachedRow>& detached = {}, size_t detachedTotal = 0) const
+    {
+        size_t total = (candidates ? candidates->size() : rows.size()) + detachedTotal;
+        if (total == 0)
+        {
+            cout << "No " << title << ".\n";
+            return;
+        }
+        if (pageSize == 0) pageSize = 10;
+        size_t pages = (total + pageSize - 1) / pageSize;
+        if (page >= pages)
+        {
+            cout << "Page " << (page + 1) << " is out of range (" << pages << " pages).\n";
+            return;
+        }
+
+        string keyName = key == SortKey::AMOUNT ? "amount" : (key == SortKey::DATE ? "date" : labelName);
+        cout << "\n=== " << title << " by " << keyName << (descending ? " (descending)" : " (ascending)")
+             << ", page " << (page + 1) << " of " << pages << " ===\n";
+        if (detachedTotal == 0)
+        {
+            for (size_t pos : orderedSlice(rows, candidates, cache, key, descending, page * pageSize, (page + 1) * pageSize))
+            {
+                cout << pos << ": ";
+                rows[pos].viewTrans();
+            }
+            return;
+        }
+
+        size_t end = (page + 1) * pageSize;
+        vector<size_t> hot = orderedSlice(rows, candidates, cache, key, descending, 0, end);
+        size_t h = 0, d = 0;
+        for (size_t n = 0; n < end && (h < hot.size() || d < detached.size()); ++n)
+        {
+            bool takeHot = d == detached.size();
+            if (!takeHot && h < hot.size())
+            {
+                const T& x = rows[hot[h]];
+                const DetachedRow& y = detached[d];
+                int c = compareKeys(toBase(x), x.getDate().toTimestamp(), transactionLabel(x), y.amount, y.ts, y.label, key);
+                takeHot = descending ? c >= 0 : c <= 0;
+            }
+            if (takeHot)
+            {
+                if (n >= page * pageSize)
+                {
+                    cout << hot[h] << ": ";
+                    rows[hot[h]].viewTrans();
+                }
+                h++;
+            }
+            else
+            {
+                if (n >= page * pageSize) viewDetachedRow(is_same<T, Income>::value, detached[d]);
+                d++;
+            }
+        }
+    }
+
+    // Net of every income and expense dated at or before dt.
+    double calculateBalanceAt(const Date& dt) const
+    {
+        long long dayNum = dt.toDayNumber();
+        double balance = dailyNet.sumUpTo(dayNum - 1);
+        auto today = intraDay.find(dayNum);
+        if (today != intraDay.end())
+        {
+            int offset = static_cast<int>(dt.toTimestamp() - dayNum * 86400);
+            for (const auto& e : today->second)
+            {
+                if (e.offset > offset) break;
+                balance += e.net;
+            }
+        }
+        long long cold = 0;
+        for (const auto& c : coldBlocks) cold += c.second.netCentsUpTo(dt.toTimestamp());
+        if (mapped) cold += mapped->netCentsUpTo(dt.toTimestamp());
+        return balance + cold / 100.0 + recurringTotal(true, nullptr, LLONG_MIN, dt.toTimestamp()) -
+               recurringTotal(false, nullptr, LLONG_MIN, dt.toTimestamp());
+    }
+
+    // Both overloads include every subcategory of `category`.
+    double calculateSpentInCategory(string category) const
+    {
+        long long cold = 0;
+        for (const auto& c : coldBlocks) cold += c.second.spentInCategory(category);
+        if (mapped) cold += mapped->spentInCategory(category);
+        return categoryTree.subtreeTotal(category) + cold / 100.0 +
+               recurringTotal(false, &category, LLONG_MIN, nowTimestamp());
+    }
+
+    double calculateSpentInCategory(string category, long long fromDay, long long toDay) const
+    {
+        long long cold = 0;
+        for (const auto& c : coldBlocks) cold += c.second.spentInCategory(category, fromDay * 86400, toDay * 86400 + 86399);
+        if (mapped) cold += mapped->spentInCategory(category, fromDay * 86400, toDay * 86400 + 86399);
+        return categoryTree.subtreeRange(category, fromDay, toDay) + cold / 100.0 +
+               recurringTotal(false, &category, fromDay * 86400, min(toDay * 86400 + 86399, nowTimestamp()));
+    }
+
+    // Direct subcategories of `category` seen in any tier.
+    set<string> childCategories(const string& category) const
+    {
+        set<string> result = categoryTree.children(category);
+        for (const auto& c : coldBlocks)
+        {
+            for (const auto& entry : c.second.getCategoryCents())
+            {
+                string child = childCategory(entry.first, category);
+                if (!child.empty()) result.insert(child);
+            }
+        }
+        for (const auto& r : rules)
+        {
+            string child = r.isIncome() ? "" : childCategory(r.getLabel(), category);
+            if (!child.empty()) result.insert(child);
+        }
+        return result;
+    }
+
+    // Day window [fromDay, toDay] the budget currently applies to, relative to today.
+    void getBudgetWindow(const Budget& b, long long& fromDay, long long& toDay) const
+    {
+        getBudgetWindowAt(b, getCurrentDate().toDayNumber(), fromDay, toDay);
+    }
+
+    // Same, for the window containing `day`.
+    void getBudgetWindowAt(const Budget& b, long long day, long long& fromDay, long long& toDay) const
+    {
+        Date today = Date::fromDayNumber(day);
+        long long todayNum = day;
+        if (b.getPeriod() == BudgetPeriod::MONTHLY)
+        {
+            fromDay = Date(today.getYear(), today.getMonth(), 1).toDayNumber();
+            int nextYear = today.getMonth() == 12 ? today.getYear() + 1 : today.getYear();
+            int nextMonth = today.getMonth() == 12 ? 1 : today.getMonth() + 1;
+            toDay = Date(nextYear, nextMonth, 1).toDayNumber() - 1;
+        }
+        else if (b.getPeriod() == BudgetPeriod::WEEKLY)
+        {
+            fromDay = todayNum - today.getWeekday();
+            toDay = fromDay + 6;
+        }
+        else
+        {
+            fromDay = todayNum - b.getRollingDays() + 1;
+            toDay = todayNum;
+        }
+    }
+
+    double calculateSpentForBudget(const Budget& b) const
+    {
+        if (b.getPeriod() == BudgetPeriod::ALL_TIME) return calculateSpentInCategory(b.getCategory());
+        long long fromDay, toDay;
+        getBudgetWindow(b, fromDay, toDay);
+        return calculateSpentInCategory(b.getCategory(), fromDay, toDay);
+    }
+
+    // Recurring amounts per day over [firstDay, firstDay + days), limited to
+    // `category` when given.
+    vector<double> recurringByDay(bool isIncome, const string* category, long long firstDay, size_t days) const
+    {
+        vector<double> result(days, 0);
+        for (const auto& r : rules)
+        {
+            if (r.isIncome() != isIncome || (category && !inCategory(r.getLabel(), *category))) continue;
+            r.forEachOccurrence(firstDay * 86400, (firstDay + static_cast<long long>(days)) * 86400 - 1,
+                                [&](long long ts) { result[static_cast<size_t>(dayOf(ts) - firstDay)] += r.getAmount(); });
+        }
+        return result;
+    }
+
+    BudgetForecast forecastBudget(const Budget& b, long long today, int horizon) const
+    {
+        BudgetForecast f;
+        string cat = b.getCategory();
+        f.category = cat;
+        f.period = b.periodLabel();
+        f.limit = b.getAmount();
+        f.dailyRate = cashFlow.dailyRate(false, &cat, today);
+        vector<double> recurring = recurringByDay(false, &cat, today + 1, horizon);
+        vector<double> projected(horizon);
+        for (int i = 0; i < horizon; ++i)
+            projected[i] = f.dailyRate + categoryTree.subtreeRange(cat, today + 1 + i, today + 1 + i) + recurring[i];
+
+        if (b.getPeriod() == BudgetPeriod::ROLLING_DAYS)
+        {
+            // The trailing window slides from known days into projected ones.
+            int n = b.getRollingDays();
+            vector<double> days;
+            for (long long d = today - n + 1; d <= today; ++d) days.push_back(calculateSpentInCategory(cat, d, d));
+            days.insert(days.end(), projected.begin(), projected.end());
+            double sum = 0;
+            for (int i = 0; i < n; ++i) sum += days[i];
+            f.spentToDate = sum;
+            for (int i = 0; i < horizon; ++i)
+            {
+                sum += days[n + i] - days[i];
+                f.windowSpend.push_back(sum);
+            }
+        }
+        else
+        {
+            long long fromDay = LLONG_MIN, toDay;
+            if (b.getPeriod() == BudgetPeriod::ALL_TIME)
+            {
+                f.spentToDate = calculateSpentInCategory(cat) - categoryTree.subtreeRange(cat, today + 1, Date(9999, 12, 31).toDayNumber());
+            }
+            else
+            {
+                getBudgetWindowAt(b, today, fromDay, toDay);
+                f.windowEnd = toDay;
+                f.spentToDate = calculateSpentInCategory(cat, fromDay, today);
+            }
+            // Monthly and weekly windows start over at each boundary.
+            double sum = f.spentToDate;
+            for (int i = 0; i < horizon; ++i)
+            {
+                if (fromDay != LLONG_MIN && today + 1 + i > toDay)
+                {
+                    getBudgetWindowAt(b, today + 1 + i, fromDay, toDay);
+                    sum = 0;
+                }
+                sum += projected[i];
+                f.windowSpend.push_back(sum);
+            }
+        }
+
+        if (f.spentToDate > f.limit) f.overDay = today;
+        for (int i = 0; i < horizon && f.overDay == LLONG_MAX; ++i)
+            if (f.windowSpend[i] > f.limit) f.overDay = today + 1 + i;
+        return f;
+    }
+
+    // Projects the balance and every budget over the next `horizon` days:
+    // ordinary income and spending at the model's daily rates, recurring
+    // rules and future-dated entries on their own dates. The result is kept
+    // until a row, budget or rule changes or the day rolls over; shorter
+    // horizons are read from a longer cached one.
+    const CashFlowForecast& forecast(int horizon)
+    {
+        ensureAllLoaded();
+        long long today = getCurrentDate().toDayNumber();
+        if (forecastCache.version == dataVersion && forecastCache.today == today && forecastCache.horizon >= horizon)
+            return forecastCache;
+
+        CashFlowForecast f;
+        f.version = dataVersion;
+        f.today = today;
+        f.horizon = horizon;
+        f.historyDays = cashFlow.historyDays(today);
+        f.startBalance = calculateBalanceAt(Date::fromDayNumber(today, Time(23, 59, 59)));
+        f.incomeRate = cashFlow.dailyRate(true, nullptr, today);
+        f.expenseRate = cashFlow.dailyRate(false, nullptr, today);
+        vector<double> recurringIn = recurringByDay(true, nullptr, today + 1, horizon);
+        vector<double> recurringOut = recurringByDay(false, nullptr, today + 1, horizon);
+        double balance = f.startBalance;
+        for (int i = 0; i < horizon; ++i)
+        {
+            balance += f.incomeRate - f.expenseRate + dailyNet.dayTotal(today + 1 + i) + recurringIn[i] - recurringOut[i];
+            f.balance.push_back(balance);
+        }
+        for (const auto& b : budgets) f.budgets.push_back(forecastBudget(b, today, horizon));
+        forecastCache = move(f);
+        return forecastCache;
+    }
+
+    // A category can carry one budget per period (monthly, weekly, ...).
+    vector<const Budget*> getBudgetsOfCategory(const string& category) const
+    {
+        vector<const Budget*> result;
+        for (const auto& b : budgets)
+        {
+            if (b.getCategory() == category) result.push_back(&b);
+        }
+        return result;
+    }
+
+public:
+    // Data lives in a directory of monthly partitions named after the file
+    // (finance_data.csv -> finance_data/). A legacy single CSV is migrated on
+    // first save. An empty filename keeps the tracker in memory only.
+    explicit FinanceTracker(string filename = "finance_data.csv") : dataFile(filename)
+    {
+        if (dataFile.empty()) return;
+        dataDir = filesystem::path(dataFile).replace_extension();
+        writer.setDirectory(dataDir);
+        ifstream rateFile(dataDir / "rates.csv");
+        if (rateFile.is_open())
+        {
+            stringstream contents;
+            contents << rateFile.rdbuf();
+            string rateError;
+            if (RateTable::parse(contents, rates, rateError)) ratesText = make_shared<const string>(contents.str());
+            else cout << "Warning: Exchange rates in " << (dataDir / "rates.csv").string() << " were not loaded (" << rateError << ").\n";
+        }
+        if (filesystem::exists(dataDir / "manifest.csv"))
+        {
+            openPartitions();
+        }
+        else
+        {
+            loadFromFile(dataFile);
+            if (!incomes.empty() || !expenses.empty() || !budgets.empty())
+                cout << "Data will be saved in monthly partitions under " << dataDir.string() << endl;
+        }
+    }
+
+    ~FinanceTracker()
+    {
+        savePartitions();
+        writer.stop();
+    }
+
+    // Appends without validation prompts or alerts (file loads, imports, benchmarks).
+    void appendIncome(const Income& inc)
+    {
+        if (!loadingPartition) ensureMonthLoaded(inc.getDate());
+        incomes.push_back(inc);
+        indexIncome(incomes.back());
+        // Rows read from disk by a lazy month load are not part of the change.
+        if (changeDepth > 0 && !loadingPartition) pendingChange.incomes.push_back({incomes.size() - 1, nullopt, inc});
+    }
+
+    void appendExpense(const Expense& exp)
+    {
+        if (!loadingPartition) ensureMonthLoaded(exp.getDate());
+        expenses.push_back(exp);
+        indexExpense(expenses.back());
+        if (changeDepth > 0 && !loadingPartition) pendingChange.expenses.push_back({expenses.size() - 1, nullopt, exp});
+    }
+
+    void addIncome(double amt, Date dt, string src, vector<string> tags = {}, string currency = "")
+    {
+        ChangeScope change(*this, "Add income");
+        if (amt < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if (src.empty())
+        {
+            cout << "Error: Source cannot be empty!\n";
+            return;
+        }
+        uint16_t currencyId;
+        if (!resolveCurrency(currency, currencyId))
+        {
+            cout << "Error: Invalid currency code!\n";
+            return;
+        }
+        double baseAmt = amt * rates.rate(currencyId, dt.toDayNumber());
+        const AmountStats* stats = statsFor(true, src);
+        if (stats && stats->isUnusual(baseAmt))
+            cout << "Alert: Unusually large income from " << src << " (" << amt << "; median " << stats->quantile(0.5)
+                 << ", p99 " << stats->quantile(0.99) << ")!\n";
+        ensureMonthLoaded(dt);
+        if (countMatching(true, src, amt, currencyId, dt) > 0) cout << "Warning: An identical income is already recorded (possible duplicate).\n";
+        Income inc(src, amt, dt);
+        inc.setTags(tags);
+        inc.setCurrency(currencyId);
+        appendIncome(inc);
+        cout << "Income added successfully!\n";
+    }
+
+    void viewIncomes()
+    {
+        ensureAllLoaded();
+        if (incomes.empty())
+        {
+            cout << "No incomes.\n";
+            return;
+        }
+        cout << "\n=== All Incomes ===\n";
+        for (size_t i = 0; i < incomes.size(); ++i)
+        {
+            cout << i << ": ";
+            incomes[i].viewTrans();
+        }
+        if (!coldBlocks.empty()) cout << "(" << archivedRowCount() << " older transactions are archived; use a period report to list them)\n";
+    }
+
+    // filterExpression narrows the rows first; empty means all incomes.
+    void viewIncomesSorted(SortKey key, bool descending, size_t page, size_t pageSize, string filterExpression = "")
+    {
+        ensureAllLoaded();
+        try
+        {
+            size_t detachedTotal;
+            if (filterExpression.empty())
+            {
+                vector<DetachedRow> detached = topDetachedRows(true, nullptr, key, descending, (page + 1) * (pageSize == 0 ? 10 : pageSize), detachedTotal);
+                viewSortedRows(incomes, nullptr, incomeOrders, "Incomes", "source", key, descending, page, pageSize, detached, detachedTotal);
+                return;
+            }
+            TransactionFilter filter(filterExpression);
+            FilterScanResult matched = runFilter(filter, true, true, false);
+            vector<DetachedRow> detached = topDetachedRows(true, &filter, key, descending, (page + 1) * (pageSize == 0 ? 10 : pageSize), detachedTotal);
+            viewSortedRows(incomes, &matched.incomeRows, incomeOrders, "Incomes", "source", key, descending, page, pageSize, detached, detachedTotal);
+        }
+        catch (const exception& e)
+        {
+            cout << "Error: Invalid filter: " << e.what() << "!\n";
+        }
+    }
+
+    void updateIncome(int index, double amt, Date dt, string src)
+    {
+        ChangeScope change(*this, "Update income");
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        if (amt < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if (src.empty())
+        {
+            cout << "Error: Source cannot be empty!\n";
+            return;
+        }
+        Income updated = incomes[index];
+        updated.setAmount(amt);
+        updated.setDate(dt);
+        updated.setSource(src);
+        writeIncome(index, true, updated);
+        cout << "Income updated successfully!\n";
+    }
+
+    void updateIncome(int index, int updateChoice, double amt, string src, Date dt)
+    {
+        ChangeScope change(*this, "Update income");
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        if ((updateChoice == 1 || updateChoice == 4) && amt < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if ((updateChoice == 2 || updateChoice == 4) && src.empty())
+        {
+            cout << "Error: Source cannot be empty!\n";
+            return;
+        }
+
+        Income updated = incomes[index];
+        if (updateChoice == 1)
+        {
+            updated.setAmount(amt);
+        }
+        else if (updateChoice == 2)
+        {
+            updated.setSource(src);
+        }
+        else if (updateChoice == 3)
+        {
+            updated.setDate(dt);
+        }
+        else if (updateChoice == 4)
+        {
+            updated.setAmount(amt);
+            updated.setSource(src);
+            updated.setDate(dt);
+        }
+        writeIncome(index, true, updated);
+        cout << "Income updated successfully!\n";
+    }
+
+    void setIncomeTags(int index, vector<string> tags)
+    {
+        ChangeScope change(*this, "Set income tags");
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        Income updated = incomes[index];
+        updated.setTags(tags);
+        writeIncome(index, true, updated);
+        cout << "Tags updated successfully!\n";
+    }
+
+    void deleteIncome(int index)
+    {
+        ChangeScope change(*this, "Delete income");
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(incomes.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        writeIncome(index, true, nullopt);
+        cout << "Income deleted successfully!\n";
+    }
+
+    void addExpense(double amt, Date dt, string cat, vector<string> tags = {}, string currency = "")
+    {
+        ChangeScope change(*this, "Add expense");
+        cat = normalizeCategory(cat);
+        if (amt < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if (cat.empty())
+        {
+            cout << "Error: Category cannot be empty!\n";
+            return;
+        }
+        uint16_t currencyId;
+        if (!resolveCurrency(currency, currencyId))
+        {
+            cout << "Error: Invalid currency code!\n";
+            return;
+        }
+        double baseAmt = amt * rates.rate(currencyId, dt.toDayNumber());
+
+        double currentBalance = calculateTotalIncome() - calculateTotalExpenses();
+        if (baseAmt > currentBalance)
+        {
+            cout << "\n*** Warning: The current balance ("<< currentBalance
+                 << ") is not enough for this expense ("<< baseAmt << ") ***\n";
+
+            cout << "Do you still want to continue? (y/n): ";
+
+            char confirm;
+
+            cin >> confirm;
+
+            clearInputBuffer();
+
+            if (confirm != 'y' && confirm != 'Y')
+
+            {
+                cout << "Expense canceled.\n";
+
+                return;
+
+            }
+        }
+
+        const AmountStats* stats = statsFor(false, cat);
+        if (stats && stats->isUnusual(baseAmt))
+            cout << "Alert: Unusually large expense for " << cat << " (" << amt << "; median " << stats->quantile(0.5)
+                 << ", p99 " << stats->quantile(0.99) << ")!\n";
+        ensureMonthLoaded(dt);
+        if (countMatching(false, cat, amt, currencyId, dt) > 0) cout << "Warning: An identical expense is already recorded (possible duplicate).\n";
+        Expense exp(cat, amt, dt);
+        exp.setTags(tags);
+        exp.setCurrency(currencyId);
+        appendExpense(exp);
+        cout << "Expense added successfully!\n";
+        checkBudgets();
+    }
+
+    void viewExpenses()
+    {
+        ensureAllLoaded();
+        if (expenses.empty())
+        {
+            cout << "No expenses.\n";
+            return;
+        }
+        cout << "\n=== All Expenses ===\n";
+        for (size_t i = 0; i < expenses.size(); ++i)
+        {
+            cout << i << ": ";
+            expenses[i].viewTrans();
+        }
+        if (!coldBlocks.empty()) cout << "(" << archivedRowCount() << " older transactions are archived; use a period report to list them)\n";
+    }
+
+    // filterExpression narrows the rows first; empty means all expenses.
+    void viewExpensesSorted(SortKey key, bool descending, size_t page, size_t pageSize, string filterExpression = "")
+    {
+        ensureAllLoaded();
+        try
+        {
+            size_t detachedTotal;
+            if (filterExpression.empty())
+            {
+                vector<DetachedRow> detached = topDetachedRows(false, nullptr, key, descending, (page + 1) * (pageSize == 0 ? 10 : pageSize), detachedTotal);
+                viewSortedRows(expenses, nullptr, expenseOrders, "Expenses", "category", key, descending, page, pageSize, detached, detachedTotal);
+                return;
+            }
+            TransactionFilter filter(filterExpression);
+            FilterScanResult matched = runFilter(filter, true, true, false);
+            vector<DetachedRow> detached = topDetachedRows(false, &filter, key, descending, (page + 1) * (pageSize == 0 ? 10 : pageSize), detachedTotal);
+            viewSortedRows(expenses, &matched.expenseRows, expenseOrders, "Expenses", "category", key, descending, page, pageSize, detached, detachedTotal);
+        }
+        catch (const exception& e)
+        {
+            cout << "Error: Invalid filter: " << e.what() << "!\n";
+        }
+    }
+
+    void updateExpense(int index, double amt, Date dt, string cat)
+    {
+        ChangeScope change(*this, "Update expense");
+        cat = normalizeCategory(cat);
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        if (amt < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if (cat.empty())
+        {
+            cout << "Error: Category cannot be empty!\n";
+            return;
+        }
+        Expense updated = expenses[index];
+        updated.setAmount(amt);
+        updated.setDate(dt);
+        updated.setCategory(cat);
+        writeExpense(index, true, updated);
+        cout << "Expense updated successfully!\n";
+    }
+
+    void updateExpense(int index, int updateChoice, double amt, string cat, Date dt)
+    {
+        ChangeScope change(*this, "Update expense");
+        cat = normalizeCategory(cat);
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        if ((updateChoice == 1 || updateChoice == 4) && amt < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if ((updateChoice == 2 || updateChoice == 4) && cat.empty())
+        {
+            cout << "Error: Category cannot be empty!\n";
+            return;
+        }
+
+        Expense updated = expenses[index];
+        if (updateChoice == 1)
+        {
+            updated.setAmount(amt);
+        }
+        else if (updateChoice == 2)
+        {
+            updated.setCategory(cat);
+        }
+        else if (updateChoice == 3)
+        {
+            updated.setDate(dt);
+        }
+        else if (updateChoice == 4)
+        {
+            updated.setAmount(amt);
+            updated.setCategory(cat);
+            updated.setDate(dt);
+        }
+        writeExpense(index, true, updated);
+        cout << "Expense updated successfully!\n";
+    }
+
+    void setExpenseTags(int index, vector<string> tags)
+    {
+        ChangeScope change(*this, "Set expense tags");
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        Expense updated = expenses[index];
+        updated.setTags(tags);
+        writeExpense(index, true, updated);
+        cout << "Tags updated successfully!\n";
+    }
+
+    void deleteExpense(int index)
+    {
+        ChangeScope change(*this, "Delete expense");
+        ensureAllLoaded();
+        if (index < 0 || index >= static_cast<int>(expenses.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        writeExpense(index, true, nullopt);
+        cout << "Expense deleted successfully!\n";
+    }
+
+    void setBudget(string category, double limit, BudgetPeriod period = BudgetPeriod::ALL_TIME, int rollingDays = 0)
+    {
+        ChangeScope change(*this, "Set budget");
+        category = normalizeCategory(category);
+        if (limit < 0)
+        {
+            cout << "Error: Negative limit!\n";
+            return;
+        }
+        if (category.empty())
+        {
+            cout << "Error: Category cannot be empty!\n";
+            return;
+        }
+        if (period == BudgetPeriod::ROLLING_DAYS && rollingDays <= 0)
+        {
+            cout << "Error: Rolling window must be at least one day!\n";
+            return;
+        }
+        for (size_t i = 0; i < budgets.size(); ++i)
+        {
+            if (budgets[i].getCategory() == category && budgets[i].samePeriod(period, rollingDays))
+            {
+                Budget updated = budgets[i];
+                updated.setAmount(limit);
+                writeSetting(budgets, pendingChange.budgets, i, true, updated);
+                cout << "Budget for " << category << " (" << updated.periodLabel() << ") updated to " << limit << endl;
+                return;
+            }
+        }
+        writeSetting(budgets, pendingChange.budgets, budgets.size(), false, Budget(category, limit, period, rollingDays));
+        cout << "New budget created for " << category << " (" << budgets.back().periodLabel() << "): " << limit << endl;
+    }
+
+    void addRecurringRule(bool isIncome, string label, double amount, Cadence cadence, int interval, Date start, Date end)
+    {
+        ChangeScope change(*this, "Add recurring rule");
+        if (!isIncome) label = normalizeCategory(label);
+        if (amount < 0)
+        {
+            cout << "Error: Negative amount!\n";
+            return;
+        }
+        if (label.empty())
+        {
+            cout << "Error: " << (isIncome ? "Source" : "Category") << " cannot be empty!\n";
+            return;
+        }
+        if (interval < 1)
+        {
+            cout << "Error: Interval must be at least 1!\n";
+            return;
+        }
+        if (end < start)
+        {
+            cout << "Error: The end date is older than the start date!\n";
+            return;
+        }
+        writeSetting(rules, pendingChange.rules, rules.size(), false, RecurringRule(isIncome, label, amount, cadence, interval, start, end));
+        cout << "Recurring " << (isIncome ? "income" : "expense") << " added (" << rules.back().cadenceLabel() << ").\n";
+    }
+
+    void viewRecurringRules() const
+    {
+        if (rules.empty())
+        {
+            cout << "No recurring transactions.\n";
+            return;
+        }
+        long long now = nowTimestamp();
+        cout << "\n=== Recurring Transactions ===\n";
+        for (size_t i = 0; i < rules.size(); ++i)
+        {
+            const RecurringRule& r = rules[i];
+            long long count = r.countBetween(LLONG_MIN, now);
+            cout << i << ": " << (r.isIncome() ? "Income  " : "Expense ") << r.getLabel() << " " << fixed << setprecision(2)
+                 << r.getAmount() << " " << r.cadenceLabel() << " from " << r.getStart().toString().substr(0, 10);
+            if (r.getEnd().getYear() < 9999) cout << " to " << r.getEnd().toString().substr(0, 10);
+            cout << " | " << count << " so far, total " << r.getAmount() * count << endl;
+        }
+    }
+
+    void deleteRecurringRule(int index)
+    {
+        ChangeScope change(*this, "Delete recurring rule");
+        if (index < 0 || index >= static_cast<int>(rules.size()))
+        {
+            cout << "Invalid index!\n";
+            return;
+        }
+        writeSetting(rules, pendingChange.rules, index, true, nullopt);
+        cout << "Recurring transaction deleted successfully!\n";
+    }
+
+    void checkBudgets()
+    {
+        if (budgets.empty())
+        {
+            cout << "\nNo budgets have been set yet.\n";
+            return;
+        }
+        for (const auto& b : budgets)
+        {
+            if (b.getPeriod() == BudgetPeriod::ALL_TIME)
+            {
+                ensureAllLoaded();
+                break;
+            }
+            long long fromDay, toDay;
+            getBudgetWindow(b, fromDay, toDay);
+            ensureRangeLoaded(Date::fromDayNumber(fromDay), Date::fromDayNumber(toDay));
+        }
+        cout << "\nBudget Status:\n";
+        if (reportCurrency != 0) cout << "(in " << currencyName(reportCurrency) << ")\n";
+        for (const auto& b : budgets)
+        {
+            string cat = b.getCategory();
+            double limit = b.getAmount();
+            double spent = calculateSpentForBudget(b);
+            if (reportCurrency != 0)
+            {
+                // Limits are set in the base currency; convert them at today's rate.
+                long long fromTs = LLONG_MIN, toTs = LLONG_MAX;
+                if (b.getPeriod() != BudgetPeriod::ALL_TIME)
+                {
+                    long long fromDay, toDay;
+                    getBudgetWindow(b, fromDay, toDay);
+                    fromTs = fromDay * 86400;
+                    toTs = toDay * 86400 + 86399;
+                }
+                spent = convertedTotals(reportCurrency, &cat, fromTs, toTs).second;
+                limit /= rates.rate(reportCurrency, getCurrentDate().toDayNumber());
+            }
+            double percentage = (limit > 0) ? (spent / limit) * 100 : 0;
+            cout << cat;
+            if (b.getPeriod() != BudgetPeriod::ALL_TIME) cout << " (" << b.periodLabel() << ")";
+            cout << ": ";
+            if (spent > limit)
+            {
+                cout << "EXCEEDED by " << (spent - limit) << " (" << fixed << setprecision(1) << percentage << "%)\n";
+            }
+            else if (spent > limit * 0.9)
+            {
+                cout << "WARNING: " << fixed << setprecision(1) << percentage << "% used (" << (limit - spent) << " remaining)\n";
+            }
+            else
+            {
+                cout << fixed << setprecision(1) << percentage << "% used (" << (limit - spent) << " remaining)\n";
+            }
+        }
+        cout << endl;
+    }
+
+    void generateSummary()
+    {
+        double income = calculateTotalIncome();
+        double expense = calculateTotalExpenses();
+        if (reportCurrency != 0)
+        {
+            ensureAllLoaded();
+            pair<double, double> totals = convertedTotals(reportCurrency, nullptr, LLONG_MIN, LLONG_MAX);
+            income = totals.first;
+            expense = totals.second;
+        }
+        double balance = income - expense;
+        cout << "\n=== Financial Summary ===\n";
+        if (reportCurrency != 0) cout << "(in " << currencyName(reportCurrency) << ")\n";
+        cout << "Total Income: " << fixed << setprecision(2) << income << endl;
+        cout << "Total Expenses: " << fixed << setprecision(2) << expense << endl;
+        cout << "Current Balance: " << fixed << setprecision(2) << balance << endl;
+        cout << "========================\n\n";
+    }
+
+    void generateDetailed(string category)
+    {
+        ensureAllLoaded();
+        category = normalizeCategory(category);
+        if (category.empty())
+        {
+            cout << "Error: Category cannot be empty!\n";
+            return;
+        }
+        generateSummary();
+        vector<const Budget*> own = getBudgetsOfCategory(category);
+        if (own.empty()) cout << "Your Budget for category : " << category << " is 0" << endl;
+        for (const Budget* b : own)
+        {
+            cout << "Your Budget for category : " << category << " (" << b->periodLabel() << ") is " << b->getAmount()
+                 << ", spent " << calculateSpentForBudget(*b) << " in the current period" << endl;
+        }
+        cout << "You spent " << calculateSpentInCategory(category) << " on this category" << endl;
+        refreshStats();
+        auto stats = expenseStats.find(category);
+        if (stats != expenseStats.end())
+        {
+            cout << "Typical expense: median " << stats->second.quantile(0.5) << ", p95 " << stats->second.quantile(0.95)
+                 << " over " << stats->second.getCount() << " transactions" << endl;
+        }
+        set<string> children = childCategories(category);
+        if (!children.empty())
+        {
+            cout << "Subcategories:" << endl;
+            for (const auto& child : children)
+            {
+                cout << "  " << child << ": " << calculateSpentInCategory(child);
+                for (const Budget* b : getBudgetsOfCategory(child))
+                    cout << " (" << b->periodLabel() << " budget " << b->getAmount() << ")";
+                cout << endl;
+            }
+        }
+        cout << "Details:" << endl;
+        bool found = false;
+        for (size_t i = 0; i < expenses.size(); ++i)
+        {
+            if (inCategory(expenses[i].getCategory(), category))
+            {
+                expenses[i].viewTrans();
+                found = true;
+            }
+        }
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.hasCategory(category)) continue;
+            c.second.forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+            {
+                if (isIncome || !inCategory(label, category)) return;
+                archivedExpense(label, cents, ts).viewTrans();
+                found = true;
+            });
+        }
+        if (mapped)
+        {
+            mapped->forEachInCategory(category, [&](const MappedLedger::Row& r)
+            {
+                archivedExpense(MappedLedger::labelOf(r), r.cents, r.ts).viewTrans();
+                found = true;
+            });
+        }
+        for (const auto& r : rules)
+        {
+            if (r.isIncome() || !inCategory(r.getLabel(), category)) continue;
+            r.forEachOccurrence(LLONG_MIN, nowTimestamp(), [&](long long ts)
+            {
+                cout << "(recurring) ";
+                Expense(r.getLabel(), r.getAmount(), Date::fromTimestamp(ts)).viewTrans();
+                found = true;
+            });
+        }
+        if (!found) cout << "No expenses found in this category.\n";
+    }
+
+    void generateReportForPeriod(Date start, Date end)
+    {
+        if (start > end)
+        {
+            cout << "Error: The start date is newer than the end date! We will be swapping the dates.\n";
+            Date temp = start;
+            start = end;
+            end = temp;
+        }
+        ensureRangeLoaded(start, end);
+        long long fromTs = start.toTimestamp();
+        long long toTs = end.toTimestamp();
+        cout << "\nTransactions from " << start.toString() << " to " << end.toString() << ":\n";
+        cout << "\nYour Incomes:\n";
+        bool foundIncome = false;
+        for (size_t i = 0; i < incomes.size(); ++i)
+        {
+            if (incomes[i].getDate() >= start && incomes[i].getDate() <= end)
+            {
+                incomes[i].viewTrans();
+                foundIncome = true;
+            }
+        }
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.overlaps(fromTs, toTs)) continue;
+            c.second.forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+            {
+                if (!isIncome || ts < fromTs || ts > toTs) return;
+                archivedIncome(label, cents, ts).viewTrans();
+                foundIncome = true;
+            });
+        }
+        if (mapped)
+        {
+            mapped->scanRange(fromTs, toTs, [&](const MappedLedger::Row& r)
+            {
+                if (!r.isIncome) return;
+                archivedIncome(MappedLedger::labelOf(r), r.cents, r.ts).viewTrans();
+                foundIncome = true;
+            });
+        }
+        // Occurrences count up to today, as in the totals below.
+        for (const auto& r : rules)
+        {
+            if (!r.isIncome()) continue;
+            r.forEachOccurrence(fromTs, min(toTs, nowTimestamp()), [&](long long ts)
+            {
+                cout << "(recurring) ";
+                Income(r.getLabel(), r.getAmount(), Date::fromTimestamp(ts)).viewTrans();
+                foundIncome = true;
+            });
+        }
+        if (!foundIncome) cout << "No incomes in this period.\n";
+
+        cout << "\nYour Expenses:\n";
+        bool foundExpense = false;
+        for (size_t i = 0; i < expenses.size(); ++i)
+        {
+            if (expenses[i].getDate() >= start && expenses[i].getDate() <= end)
+            {
+                expenses[i].viewTrans();
+                foundExpense = true;
+            }
+        }
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.overlaps(fromTs, toTs)) continue;
+            c.second.forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+            {
+                if (isIncome || ts < fromTs || ts > toTs) return;
+                archivedExpense(label, cents, ts).viewTrans();
+                foundExpense = true;
+            });
+        }
+        if (mapped)
+        {
+            mapped->scanRange(fromTs, toTs, [&](const MappedLedger::Row& r)
+            {
+                if (r.isIncome) return;
+                archivedExpense(MappedLedger::labelOf(r), r.cents, r.ts).viewTrans();
+                foundExpense = true;
+            });
+        }
+        for (const auto& r : rules)
+        {
+            if (r.isIncome()) continue;
+            r.forEachOccurrence(fromTs, min(toTs, nowTimestamp()), [&](long long ts)
+            {
+                cout << "(recurring) ";
+                Expense(r.getLabel(), r.getAmount(), Date::fromTimestamp(ts)).viewTrans();
+                foundExpense = true;
+            });
+        }
+        if (!foundExpense) cout << "No expenses in this period.\n";
+        pair<double, double> totals = convertedTotals(reportCurrency, nullptr, fromTs, toTs);
+        cout << "\nTotals in " << currencyName(reportCurrency) << ": income " << fixed << setprecision(2) << totals.first
+             << ", expenses " << totals.second << ", net " << totals.first - totals.second << "\n";
+    }
+
+    // withDetached adds archived and mapped rows and recurring occurrences
+    // to the counts and sums (and to archivedIncomes/archivedExpenses when
+    // collecting).
+    FilterScanResult runFilter(const TransactionFilter& filter, bool collectRows, bool parallel = true, bool withDetached = true) const
+    {
+        FilterScanResult result;
+        scanFiltered(incomes, true, filter, collectRows, parallel, result.incomeCount, result.incomeSum, result.incomeRows);
+        scanFiltered(expenses, false, filter, collectRows, parallel, result.expenseCount, result.expenseSum, result.expenseRows);
+        if (withDetached) scanDetached(filter, collectRows, result);
+        return result;
+    }
+
+    // Hot rows are answered from the tag bitmaps; archived years with tags
+    // are decoded and tested row by row.
+    FilterScanResult runTagQuery(const TagQuery& query, bool collectRows)
+    {
+        ensureAllLoaded();
+        incomeTags.refresh(incomes);
+        expenseTags.refresh(expenses);
+        FilterScanResult result;
+        query.evaluate(incomeTags, incomes.size()).forEach([&](uint32_t i)
+        {
+            result.incomeCount++;
+            result.incomeSum += toBase(incomes[i]);
+            if (collectRows) result.incomeRows.push_back(i);
+        });
+        query.evaluate(expenseTags, expenses.size()).forEach([&](uint32_t i)
+        {
+            result.expenseCount++;
+            result.expenseSum += toBase(expenses[i]);
+            if (collectRows) result.expenseRows.push_back(i);
+        });
+        vector<string> tags;
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.hasTags() && !query.matches(tags)) continue;
+            c.second.forEachTaggedRow([&](bool isIncome, const string&, long long cents, long long, const string& joined)
+            {
+                tags = parseTagList(joined);
+                if (!query.matches(tags)) return;
+                if (isIncome)
+                {
+                    result.incomeCount++;
+                    result.incomeSum += cents / 100.0;
+                }
+                else
+                {
+                    result.expenseCount++;
+                    result.expenseSum += cents / 100.0;
+                }
+            });
+            tags.clear();
+        }
+        return result;
+    }
+
+    void generateTagReport(string expression, bool listRows)
+    {
+        try
+        {
+            FilterScanResult result = runTagQuery(TagQuery(expression), listRows);
+            cout << "\n=== Tag Query Results ===\n";
+            cout << "Incomes matched: " << result.incomeCount << " (total " << fixed << setprecision(2) << result.incomeSum << ")\n";
+            cout << "Expenses matched: " << result.expenseCount << " (total " << fixed << setprecision(2) << result.expenseSum << ")\n";
+            cout << "Net: " << fixed << setprecision(2) << (result.incomeSum - result.expenseSum) << endl;
+            if (!listRows) return;
+            if (!result.incomeRows.empty()) cout << "\nIncomes:\n";
+            for (size_t i : result.incomeRows)
+            {
+                cout << i << ": ";
+                incomes[i].viewTrans();
+            }
+            if (!result.expenseRows.empty()) cout << "\nExpenses:\n";
+            for (size_t i : result.expenseRows)
+            {
+                cout << i << ": ";
+                expenses[i].viewTrans();
+            }
+            if (!coldBlocks.empty()) cout << "(archived matches are counted in the totals but not listed)\n";
+        }
+        catch (const exception& e)
+        {
+            cout << "Error: Invalid tag query: " << e.what() << "!\n";
+        }
+    }
+
+    // Count, mean, spread, median and p95 per source and per category, read
+    // from the running statistics without scanning any rows.
+    void generateCategoryStats()
+    {
+        refreshStats();
+        if (incomeStats.empty() && expenseStats.empty())
+        {
+            cout << "No transactions yet.\n";
+            return;
+        }
+        auto printTable = [](const string& title, const map<string, AmountStats>& stats)
+        {
+            if (stats.empty()) return;
+            cout << "\n" << title << ":\n" << fixed << setprecision(2);
+            cout << left << setw(24) << "" << right << setw(8) << "Count" << setw(12) << "Mean" << setw(12) << "StdDev"
+                 << setw(12) << "Median" << setw(12) << "p95" << "\n";
+            for (const auto& s : stats)
+            {
+                cout << left << setw(24) << (s.first.empty() ? "(all)" : s.first) << right << setw(8) << s.second.getCount()
+                     << setw(12) << s.second.getMean() << setw(12) << s.second.getStdDev() << setw(12) << s.second.quantile(0.5)
+                     << setw(12) << s.second.quantile(0.95) << "\n";
+            }
+        };
+        cout << "\n=== Category Statistics ===\n";
+        printTable("Incomes by source", incomeStats);
+        printTable("Expenses by category", expenseStats);
+        cout << "(Medians and percentiles are within 1% of the exact amount; recurring rules are not included.)\n";
+    }
+
+    void generateForecast(int horizon)
+    {
+        if (horizon < 1 || horizon > maxForecastDays)
+        {
+            cout << "Error: The horizon must be 1-" << maxForecastDays << " days!\n";
+            return;
+        }
+        const CashFlowForecast& f = forecast(horizon);
+        auto dayText = [](long long day) { return Date::fromDayNumber(day).toString().substr(0, 10); };
+        long long lastDay = f.today + horizon;
+
+        cout << "\n=== Cash-Flow Forecast (next " << horizon << " days) ===\n" << fixed << setprecision(2);
+        cout << "Balance today: " << f.startBalance << "\n";
+        cout << "Typical daily income: " << f.incomeRate << " ,spending: " << f.expenseRate << " (from "
+             << min(f.historyDays, 365LL) << " days of history; recurring and future-dated entries count on their dates)\n";
+        for (int days : {7, 30, 90, 180, 365, 730, 1825})
+        {
+            if (days < horizon) cout << "In " << days << " days (" << dayText(f.today + days) << "): " << f.balance[days - 1] << "\n";
+        }
+        cout << "In " << horizon << " days (" << dayText(lastDay) << "): " << f.balance[horizon - 1] << "\n";
+
+        int lowest = 0, negative = -1;
+        for (int i = 0; i < horizon; ++i)
+        {
+            if (f.balance[i] < f.balance[lowest]) lowest = i;
+            if (negative < 0 && f.balance[i] < 0) negative = i;
+        }
+        cout << "Lowest: " << f.balance[lowest] << " on " << dayText(f.today + 1 + lowest) << "\n";
+        if (f.startBalance < 0) cout << "*** The balance is already negative ***\n";
+        else if (negative >= 0) cout << "*** The balance goes negative around " << dayText(f.today + 1 + negative) << " (in " << negative + 1 << " days) ***\n";
+        else cout << "The balance stays positive through " << dayText(lastDay) << ".\n";
+
+        if (f.budgets.empty()) return;
+        cout << "\nBudgets:\n";
+        for (const auto& b : f.budgets)
+        {
+            long long endDay = min(b.windowEnd, lastDay);
+            cout << "- " << b.category << " (" << b.period << ", limit " << b.limit << "): spent " << b.spentToDate
+                 << ", about " << b.dailyRate << "/day";
+            if (endDay > f.today) cout << ", projected " << b.windowSpend[endDay - f.today - 1] << " by " << dayText(endDay);
+            if (b.overDay == f.today) cout << "\n  *** Already over budget ***\n";
+            else if (b.overDay <= lastDay) cout << "\n  *** Over budget around " << dayText(b.overDay) << " (in " << b.overDay - f.today << " days) ***\n";
+            else cout << "\n  Within budget through " << dayText(lastDay) << "\n";
+        }
+    }
+
+    void viewTags()
+    {
+        ensureAllLoaded();
+        incomeTags.refresh(incomes);
+        expenseTags.refresh(expenses);
+        set<string> names;
+        for (const auto& t : incomeTags.all()) names.insert(t.first);
+        for (const auto& t : expenseTags.all()) names.insert(t.first);
+        if (names.empty())
+        {
+            cout << "No tagged transactions.\n";
+            return;
+        }
+        cout << "\n=== Tags ===\n";
+        for (const auto& name : names)
+        {
+            double spent = 0;
+            expenseTags.get(name).forEach([&](uint32_t i) { spent += toBase(expenses[i]); });
+            cout << name << ": " << incomeTags.get(name).cardinality() << " incomes, " << expenseTags.get(name).cardinality()
+                 << " expenses (spent " << fixed << setprecision(2) << spent << ")\n";
+        }
+    }
+
+    void generateFilteredReport(string expression, bool listRows)
+    {
+        ensureAllLoaded();
+        try
+        {
+            TransactionFilter filter(expression);
+            FilterScanResult result = runFilter(filter, listRows);
+
+            cout << "\n=== Filter Results ===\n";
+            cout << "Incomes matched: " << result.incomeCount << " (total " << fixed << setprecision(2) << result.incomeSum << ")\n";
+            cout << "Expenses matched: " << result.expenseCount << " (total " << fixed << setprecision(2) << result.expenseSum << ")\n";
+            cout << "Net: " << fixed << setprecision(2) << (result.incomeSum - result.expenseSum) << endl;
+            if (result.archivedCount > 0) cout << "(includes " << result.archivedCount << " archived transactions)\n";
+            if (result.recurringCount > 0) cout << "(includes " << result.recurringCount << " recurring occurrences)\n";
+            if (!listRows) return;
+
+            if (!result.incomeRows.empty() || !result.archivedIncomes.empty()) cout << "\nIncomes:\n";
+            for (size_t i : result.incomeRows)
+            {
+                cout << i << ": ";
+                incomes[i].viewTrans();
+            }
+            for (const auto& r : result.archivedIncomes) viewDetachedRow(true, r);
+            if (!result.expenseRows.empty() || !result.archivedExpenses.empty()) cout << "\nExpenses:\n";
+            for (size_t i : result.expenseRows)
+            {
+                cout << i << ": ";
+                expenses[i].viewTrans();
+            }
+            for (const auto& r : result.archivedExpenses) viewDetachedRow(false, r);
+        }
+        catch (const exception& e)
+        {
+            cout << "Error: Invalid filter: " << e.what() << "!\n";
+        }
+    }
+
+    void generateBalanceTimeline(Date start, Date end, int stepDays)
+    {
+        ensureAllLoaded();
+        if (start > end)
+        {
+            cout << "Error: The start date is newer than the end date! We will be swapping the dates.\n";
+            Date temp = start;
+            start = end;
+            end = temp;
+        }
+        if (stepDays < 1) stepDays = 1;
+
+        long long firstDay = start.toDayNumber();
+        long long lastDay = end.toDayNumber();
+        double balance = calculateBalanceAt(Date::fromDayNumber(firstDay - 1, Time(23, 59, 59)));
+
+        // Archived years inside the range are decoded once into their own day totals.
+        DailyTotals coldNet;
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.overlaps(firstDay * 86400, lastDay * 86400 + 86399)) continue;
+            c.second.forEachRow([&](bool isIncome, const string&, long long cents, long long ts)
+            {
+                coldNet.add(Date::fromTimestamp(ts).toDayNumber(), (isIncome ? cents : -cents) / 100.0);
+            });
+        }
+
+        cout << "\nBalance timeline from " << start.toString() << " to " << end.toString() << ":\n";
+        cout << "Opening balance: " << fixed << setprecision(2) << balance << endl;
+        long long prevDay = firstDay - 1;
+        for (long long d = firstDay; d <= lastDay; d += stepDays)
+        {
+            balance += dailyNet.sumRange(prevDay + 1, d) + coldNet.sumRange(prevDay + 1, d) +
+                       recurringTotal(true, nullptr, (prevDay + 1) * 86400, d * 86400 + 86399) -
+                       recurringTotal(false, nullptr, (prevDay + 1) * 86400, d * 86400 + 86399);
+            prevDay = d;
+            cout << Date::fromDayNumber(d).toString().substr(0, 10) << "  " << fixed << setprecision(2) << balance << endl;
+        }
+        if (prevDay != lastDay)
+        {
+            balance += dailyNet.sumRange(prevDay + 1, lastDay) + coldNet.sumRange(prevDay + 1, lastDay) +
+                       recurringTotal(true, nullptr, (prevDay + 1) * 86400, lastDay * 86400 + 86399) -
+                       recurringTotal(false, nullptr, (prevDay + 1) * 86400, lastDay * 86400 + 86399);
+            cout << Date::fromDayNumber(lastDay).toString().substr(0, 10) << "  " << fixed << setprecision(2) << balance << endl;
+        }
+        cout << "Balance at " << end.toString() << ": " << fixed << setprecision(2) << calculateBalanceAt(end) << endl;
+    }
+
+    void saveToFile(string filename)
+    {
+        ensureAllLoaded();
+        ofstream file(filename);
+        if (!file.is_open())
+        {
+            cout << "Error opening file for saving!\n";
+            return;
+        }
+        file << setprecision(15);
+        for (const auto& inc : incomes) writeRecord(file, inc);
+        for (const auto& exp : expenses) writeRecord(file, exp);
+        for (const auto& c : coldBlocks)
+        {
+            c.second.forEachTaggedRow([&](bool isIncome, const string& label, long long cents, long long ts, const string& tags)
+            {
+                if (isIncome) writeRecord(file, archivedIncome(label, cents, ts, tags));
+                else writeRecord(file, archivedExpense(label, cents, ts, tags));
+            });
+        }
+        writeSettings(file);
+        file.close();
+        cout << "Data saved to " << filename << endl;
+    }
+
+    void loadFromFile(string filename)
+    {
+        ifstream file(filename);
+        if (!file.is_open())
+        {
+            cout << "No save file foundstarting fresh.\n";
+            return;
+        }
+
+        string line;
+        int lineNum = 0;
+        while (getline(file, line))
+        {
+            lineNum++;
+            loadRecord(line, lineNum);
+        }
+        file.close();
+        cout << "Loaded from " << filename << " (" << incomes.size() << " incomes, "
+             << expenses.size() << " expenses, " << budgets.size() << " budgets)\n";
+    }
+
+    // Reads INCOME/EXPENSE lines (the save file format) and checks each one
+    // against the content-hash index before adding it. Accepted rows are
+    // appended after the scan so rows from the same file never match each other.
+    ImportResult importRecords(istream& in, DuplicatePolicy policy)
+    {
+        ImportResult result;
+        vector<Income> newIncomes;
+        vector<Expense> newExpenses;
+        unordered_map<uint64_t, uint32_t> paired;
+        string line;
+        int lineNum = 0;
+        rowHashes.reserve(rowHashes.size() * 2);
+        while (getline(in, line))
+        {
+            lineNum++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            size_t c1 = line.find(',');
+            size_t c2 = c1 == string::npos ? c1 : line.find(',', c1 + 1);
+            size_t c3 = c2 == string::npos ? c2 : line.find(',', c2 + 1);
+            if (c3 == string::npos)
+            {
+                if (!line.empty()) result.invalid++;
+                continue;
+            }
+            string type = line.substr(0, c1);
+            string label = line.substr(c1 + 1, c2 - c1 - 1);
+            if (type == "EXPENSE") label = normalizeCategory(label);
+            string amountText = line.substr(c2 + 1, c3 - c2 - 1);
+            size_t c4 = line.find(',', c3 + 1);
+            string dateText = line.substr(c3 + 1, c4 == string::npos ? string::npos : c4 - c3 - 1);
+            vector<string> tags;
+            uint16_t currency = 0;
+            if (c4 != string::npos) parseRecordExtras(line.substr(c4 + 1), tags, currency);
+            double amt;
+            Date dt;
+            if ((type != "INCOME" && type != "EXPENSE") || label.empty() ||
+                    !parseTransactionFields(amountText, dateText, amt, dt) || amt < 0)
+            {
+                result.invalid++;
+                continue;
+            }
+
+            bool isIncome = type == "INCOME";
+            ensureMonthLoaded(dt);
+            uint64_t h = rowFingerprint(isIncome, label, toCents(amt), currency, dt.toTimestamp());
+            auto it = rowHashes.find(h);
+            uint32_t existing = it == rowHashes.end() ? 0 : it->second;
+            bool duplicate = policy == DuplicatePolicy::MERGE ? existing > 0 && ++paired[h] <= existing : existing > 0;
+            if (duplicate)
+            {
+                result.duplicates++;
+                if (policy != DuplicatePolicy::FLAG) continue;
+                result.flaggedLines.push_back(lineNum);
+            }
+            if (isIncome)
+            {
+                newIncomes.push_back(Income(label, amt, dt));
+                newIncomes.back().setTags(tags);
+                newIncomes.back().setCurrency(currency);
+            }
+            else
+            {
+                newExpenses.push_back(Expense(label, amt, dt));
+                newExpenses.back().setTags(tags);
+                newExpenses.back().setCurrency(currency);
+            }
+        }
+
+        incomes.reserve(incomes.size() + newIncomes.size());
+        expenses.reserve(expenses.size() + newExpenses.size());
+        for (const auto& inc : newIncomes) appendIncome(inc);
+        for (const auto& exp : newExpenses) appendExpense(exp);
+        result.imported = newIncomes.size() + newExpenses.size();
+        return result;
+    }
+
+    void importFile(string filename, DuplicatePolicy policy)
+    {
+        ChangeScope change(*this, "Import " + filename);
+        ifstream file(filename);
+        if (!file.is_open())
+        {
+            cout << "Error: Could not open " << filename << "!\n";
+            return;
+        }
+        ImportResult result = importRecords(file, policy);
+        cout << "Imported " << result.imported << " transactions from " << filename << ".\n";
+        if (policy == DuplicatePolicy::FLAG)
+        {
+            cout << result.duplicates << " of them were already recorded";
+            if (!result.flaggedLines.empty())
+            {
+                cout << " (lines";
+                for (size_t i = 0; i < result.flaggedLines.size() && i < 20; ++i) cout << " " << result.flaggedLines[i];
+                if (result.flaggedLines.size() > 20) cout << " ...";
+                cout << ")";
+            }
+            cout << ".\n";
+        }
+        else cout << result.duplicates << " duplicates " << (policy == DuplicatePolicy::MERGE ? "merged" : "skipped") << ".\n";
+        if (result.invalid > 0) cout << result.invalid << " line(s) were not valid transactions and were ignored.\n";
+    }
+
+    // Spills every ledger transaction in [fromTs, toTs] across the hot,
+    // archived, mapped and recurring tiers (occurrences up to now) into
+    // `ledger`, which hands them back by (timestamp, amount). Hot rows are
+    // taken month by month from their month positions. Amounts are in the
+    // base currency.
+    bool sortLedgerRows(StatementSorter& ledger, long long fromTs, long long toTs)
+    {
+        Date first = Date::fromTimestamp(fromTs), last = Date::fromTimestamp(toTs);
+        ensureRangeLoaded(first, last);
+        return ledger.sortRows([&](const auto& push)
+        {
+            auto add = [&](long long ts, long long cents, const string& label)
+            {
+                if (ts < fromTs || ts > toTs) return;
+                ReconcileRow row;
+                row.ts = ts;
+                row.cents = cents;
+                row.line = -1;
+                row.label = label;
+                push(move(row));
+            };
+            for (int key = monthKey(first); key <= monthKey(last); key = key % 100 == 12 ? key + 89 : key + 1)
+            {
+                for (size_t pos : incomeMonths.positions(key))
+                    add(incomes[pos].getDate().toTimestamp(), toCents(toBase(incomes[pos])), incomes[pos].getSource());
+                for (size_t pos : expenseMonths.positions(key))
+                    add(expenses[pos].getDate().toTimestamp(), -toCents(toBase(expenses[pos])), expenses[pos].getCategory());
+            }
+            for (const auto& c : coldBlocks)
+            {
+                if (!c.second.overlaps(fromTs, toTs)) continue;
+                c.second.forEachRow([&](bool isIncome, const string& label, long long cents, long long ts)
+                {
+                    add(ts, isIncome ? cents : -cents, label);
+                });
+            }
+            if (mapped)
+            {
+                mapped->scanRange(fromTs, toTs, [&](const MappedLedger::Row& r)
+                {
+                    add(r.ts, r.isIncome ? r.cents : -r.cents, MappedLedger::labelOf(r));
+                });
+            }
+            for (const auto& r : rules)
+            {
+                long long cents = r.isIncome() ? toCents(r.getAmount()) : -toCents(r.getAmount());
+                r.forEachOccurrence(fromTs, min(toTs, nowTimestamp()), [&](long long ts) { add(ts, cents, r.getLabel()); });
+            }
+        }, 1 << 20);
+    }
+
+    static string describeReconcileRow(const char* kind, const ReconcileRow& row)
+    {
+        ostringstream out;
+        out << kind << "," << (row.cents >= 0 ? "INCOME," : "EXPENSE,") << row.label << "," << fixed << setprecision(2)
+            << llabs(row.cents) / 100.0 << "," << Date::fromTimestamp(row.ts).toString();
+        if (row.line > 0) out << ",line " << row.line;
+        return out.str();
+    }
+
+    // Merge-join of the sorted statement against the sorted ledger. Ledger rows
+    // enter a window keyed by amount once they are within dayTolerance days
+    // of the statement row; each statement row takes the unmatched ledger row
+    // with the closest amount (then date) within centsTolerance and the same
+    // sign. Rows that leave the window unmatched are extra if they fall on
+    // the statement's own days; those just outside only serve as candidates.
+    // Only the window's rows are held in memory; the ledger is sorted on disk
+    // next to the statement's runs.
+    ReconcileSummary reconcile(StatementSorter& statement, int dayTolerance, long long centsTolerance, ostream& unmatched)
+    {
+        ReconcileSummary summary;
+        if (statement.rowCount == 0) return summary;
+        long long slack = (dayTolerance + 1) * 86400LL;
+        StatementSorter ledger(statement.directory() / "ledger");
+        if (!sortLedgerRows(ledger, statement.minTs - slack, statement.maxTs + slack))
+        {
+            summary.complete = false;
+            return summary;
+        }
+
+        auto dayOf = [](long long ts) { return ts >= 0 ? ts / 86400 : -((-ts + 86399) / 86400); };
+        long long firstDay = dayOf(statement.minTs), lastDay = dayOf(statement.maxTs);
+        auto report = [&](bool isMissing, const ReconcileRow& row)
+        {
+            string text = describeReconcileRow(isMissing ? "MISSING" : "EXTRA", row);
+            unmatched << text << "\n";
+            vector<string>& sample = isMissing ? summary.missingSample : summary.extraSample;
+            if (sample.size() < 10) sample.push_back(text);
+            if (isMissing)
+            {
+                summary.missing++;
+                summary.missingCents += row.cents;
+            }
+            else
+            {
+                summary.extra++;
+                summary.extraCents += row.cents;
+            }
+        };
+
+        // Window values are sequence numbers; `pending` holds the ledger rows
+        // from sequence `left` on that have entered but not yet left.
+        typedef multimap<long long, size_t> Window;
+        struct Pending
+        {
+            ReconcileRow row;
+            Window::iterator slot;
+            bool matched;
+        };
+        Window window;
+        deque<Pending> pending;
+        size_t left = 0;
+        ReconcileRow upcoming;
+        bool more = ledger.next(upcoming);
+        auto expireBefore = [&](long long day)
+        {
+            for (; !pending.empty() && dayOf(pending.front().row.ts) < day; pending.pop_front(), ++left)
+            {
+                const Pending& p = pending.front();
+                if (p.matched) continue;
+                window.erase(p.slot);
+                long long ledgerDay = dayOf(p.row.ts);
+                if (ledgerDay >= firstDay && ledgerDay <= lastDay) report(false, p.row);
+            }
+        };
+
+        ReconcileRow row;
+        while (statement.next(row))
+        {
+            long long day = dayOf(row.ts);
+            for (; more && dayOf(upcoming.ts) <= day + dayTolerance; more = ledger.next(upcoming))
+            {
+                Window::iterator slot = window.emplace(upcoming.cents, left + pending.size());
+                pending.push_back({move(upcoming), slot, false});
+            }
+            expireBefore(day - dayTolerance);
+
+            Window::iterator best = window.end();
+            long long bestGap = LLONG_MAX, bestDrift = LLONG_MAX;
+            for (auto it = window.lower_bound(row.cents - centsTolerance);
+                    it != window.end() && it->first <= row.cents + centsTolerance; ++it)
+            {
+                if ((it->first < 0) != (row.cents < 0)) continue;
+                long long gap = llabs(it->first - row.cents);
+                long long drift = llabs(pending[it->second - left].row.ts - row.ts);
+                if (gap < bestGap || (gap == bestGap && drift < bestDrift))
+                {
+                    best = it;
+                    bestGap = gap;
+                    bestDrift = drift;
+                    if (gap == 0 && drift == 0) break;
+                }
+            }
+            if (best == window.end())
+            {
+                report(true, row);
+                continue;
+            }
+            summary.matched++;
+            Pending& p = pending[best->second - left];
+            if (bestGap != 0 || dayOf(p.row.ts) != day) summary.inexact++;
+            p.matched = true;
+            window.erase(best);
+        }
+        // Ledger rows not yet entered lie past the statement's last day.
+        expireBefore(LLONG_MAX);
+        return summary;
+    }
+
+    // Compares a bank statement with the ledger over the statement's dates.
+    // Every unmatched row is written to <statement>.unmatched.csv.
+    void reconcileStatement(string filename, int dayTolerance, double amountTolerance)
+    {
+        filesystem::path scratch = filesystem::temp_directory_path() /
+                                   ("finance_reconcile_" + to_string(random_device()()));
+        StatementSorter statement(scratch);
+        if (!statement.sortFile(filename, 1 << 20, max(1u, thread::hardware_concurrency())))
+        {
+            cout << "Error: Could not read " << filename << "!\n";
+            return;
+        }
+        if (statement.rowCount == 0)
+        {
+            cout << "No transactions found in " << filename << ".\n";
+            return;
+        }
+        string unmatchedPath = filename + ".unmatched.csv";
+        ofstream unmatched(unmatchedPath);
+        ReconcileSummary s = reconcile(statement, dayTolerance, toCents(amountTolerance), unmatched);
+        if (!s.complete)
+        {
+            cout << "Error: Could not sort the ledger for reconciliation!\n";
+            return;
+        }
+
+        cout << "\n=== Reconciliation: " << filename << " ===\n" << fixed << setprecision(2);
+        cout << "Statement rows: " << statement.rowCount;
+        if (statement.invalid > 0) cout << " (" << statement.invalid << " unreadable lines ignored)";
+        cout << endl;
+        cout << "Matched: " << s.matched << " (" << s.inexact << " within tolerance but not exact)\n";
+        cout << "Missing from the ledger: " << s.missing << " (net " << s.missingCents / 100.0 << ")\n";
+        for (const auto& line : s.missingSample) cout << "  " << line << endl;
+        if (s.missing > s.missingSample.size()) cout << "  ...\n";
+        cout << "In the ledger but not on the statement: " << s.extra << " (net " << s.extraCents / 100.0 << ")\n";
+        for (const auto& line : s.extraSample) cout << "  " << line << endl;
+        if (s.extra > s.extraSample.size()) cout << "  ...\n";
+        if (s.missing + s.extra > 0) cout << "All unmatched rows were written to " << unmatchedPath << endl;
+    }
+
+    // Moves every transaction dated before `year` out of the in-memory vectors
+    // into one compressed block per year (merging with an existing block).
+    void archiveYearsBefore(int year)
+    {
+        ensureAllLoaded();
+        // Cold blocks hold base-currency cents only, so foreign-currency rows
+        // stay hot to keep their original currency and amount.
+        auto archivable = [&](const Transaction& t) { return t.getDate().getYear() < year && t.getCurrency() == 0; };
+        map<int, vector<ArchivedRow>> byYear;
+        size_t foreign = 0;
+        for (const auto& inc : incomes)
+        {
+            if (archivable(inc)) byYear[inc.getDate().getYear()].push_back({inc.getDate().toTimestamp(), true, inc.getSource(), toCents(inc.getAmount()), joinTags(inc.getTags())});
+            else if (inc.getDate().getYear() < year) foreign++;
+        }
+        for (const auto& exp : expenses)
+        {
+            if (archivable(exp)) byYear[exp.getDate().getYear()].push_back({exp.getDate().toTimestamp(), false, exp.getCategory(), toCents(exp.getAmount()), joinTags(exp.getTags())});
+            else if (exp.getDate().getYear() < year) foreign++;
+        }
+        if (foreign > 0) cout << "Keeping " << foreign << " foreign-currency transactions out of the archive.\n";
+        if (byYear.empty())
+        {
+            cout << "No transactions before " << year << " to archive.\n";
+            return;
+        }
+
+        map<int, ColdBlock> built;
+        for (auto& y : byYear)
+        {
+            auto existing = coldBlocks.find(y.first);
+            if (existing != coldBlocks.end())
+            {
+                existing->second.forEachTaggedRow([&](bool isIncome, const string& label, long long cents, long long ts, const string& tags)
+                {
+                    y.second.push_back({ts, isIncome, label, cents, tags});
+                });
+            }
+            built[y.first] = ColdBlock::build(y.first, y.second);
+        }
+        if (!dataDir.empty())
+        {
+            error_code ec;
+            filesystem::create_directories(dataDir, ec);
+            for (const auto& b : built)
+            {
+                if (!writeFileDurably(coldBlockPath(dataDir, b.first), b.second.serialize()))
+                {
+                    cout << "Error: Could not write the archive for " << b.first << "!\n";
+                    return;
+                }
+            }
+        }
+
+        size_t moved = 0;
+        vector<Income> keptIncomes;
+        for (const auto& inc : incomes)
+        {
+            if (archivable(inc))
+            {
+                // The row leaves the hot indexes but stays known to duplicate
+                // detection and the statistics.
+                unindexIncome(inc);
+                countRowHash(true, inc.getSource(), toCents(inc.getAmount()), 0, inc.getDate().toTimestamp(), 1);
+                trackAmount(true, inc.getSource(), toBase(inc), 1);
+                moved++;
+            }
+            else keptIncomes.push_back(inc);
+        }
+        incomes.swap(keptIncomes);
+        incomeTags.invalidate();
+        incomeMonths.rebuild(incomes, monthKey);
+        vector<Expense> keptExpenses;
+        for (const auto& exp : expenses)
+        {
+            if (archivable(exp))
+            {
+                unindexExpense(exp);
+                countRowHash(false, exp.getCategory(), toCents(exp.getAmount()), 0, exp.getDate().toTimestamp(), 1);
+                trackAmount(false, exp.getCategory(), toBase(exp), 1);
+                moved++;
+            }
+            else keptExpenses.push_back(exp);
+        }
+        expenses.swap(keptExpenses);
+        expenseTags.invalidate();
+        expenseMonths.rebuild(expenses, monthKey);
+        for (auto& b : built) coldBlocks[b.first] = move(b.second);
+        cout << "Archived " << moved << " transactions from " << built.size() << " year(s) into cold storage.\n";
+        // Logged positions refer to rows that have just moved.
+        if (!undoHistory.empty() || !redoHistory.empty()) cout << "Undo history cleared.\n";
+        undoHistory.clear();
+        redoHistory.clear();
+    }
+
+    void undo()
+    {
+        if (undoHistory.empty())
+        {
+            cout << "Nothing to undo.\n";
+            return;
+        }
+        LedgerChange change = move(undoHistory.back());
+        undoHistory.pop_back();
+        applyChange(change, false);
+        cout << "Undone: " << change.description << " (" << change.size() << " edit(s))\n";
+        redoHistory.push_back(move(change));
+    }
+
+    void redo()
+    {
+        if (redoHistory.empty())
+        {
+            cout << "Nothing to redo.\n";
+            return;
+        }
+        LedgerChange change = move(redoHistory.back());
+        redoHistory.pop_back();
+        applyChange(change, true);
+        cout << "Redone: " << change.description << " (" << change.size() << " edit(s))\n";
+        undoHistory.push_back(move(change));
+    }
+
+    void viewHistory() const
+    {
+        cout << "\n=== Undo History (newest first, keeps " << historyDepth << ") ===\n";
+        if (undoHistory.empty()) cout << "Nothing to undo.\n";
+        for (auto it = undoHistory.rbegin(); it != undoHistory.rend(); ++it)
+            cout << "- " << it->description << " (" << it->size() << " edit(s))\n";
+        if (!redoHistory.empty()) cout << redoHistory.size() << " step(s) can be redone, next: " << redoHistory.back().description << "\n";
+    }
+
+    // Not itself an undo step: it decides how many steps are kept.
+    void setHistoryDepth(int depth)
+    {
+        if (depth < 0)
+        {
+            cout << "Error: Negative depth!\n";
+            return;
+        }
+        historyDepth = depth;
+        while (undoHistory.size() > historyDepth) undoHistory.pop_front();
+        if (historyDepth == 0) redoHistory.clear();
+        settingsDirty = true;
+        cout << "Undo history now keeps " << historyDepth << " step(s).\n";
+    }
+
+    // Replaces the exchange rates as one undo step. Foreign-currency rows are
+    // re-indexed at the new rates; archived and mapped rows were frozen in
+    // the base currency and keep their amounts.
+    void importRates(string filename)
+    {
+        ChangeScope change(*this, "Load rates from " + filename);
+        ifstream file(filename);
+        if (!file.is_open())
+        {
+            cout << "Error: Cannot open file!\n";
+            return;
+        }
+        stringstream contents;
+        contents << file.rdbuf();
+        RateTable loaded;
+        string error;
+        if (!RateTable::parse(contents, loaded, error))
+        {
+            cout << "Error: Invalid rates file (" << error << ")!\n";
+            return;
+        }
+        if (!writeCurrencies({baseCurrency, reportCurrency, make_shared<const string>(contents.str())}, &loaded)) return;
+        size_t foreign = 0;
+        for (const auto& inc : incomes)
+            if (inc.getCurrency() != 0) foreign++;
+        for (const auto& exp : expenses)
+            if (exp.getCurrency() != 0) foreign++;
+        cout << "Loaded " << rates.listedRates() << " rate(s) from " << Date::fromDayNumber(rates.getFirstDay()).toString().substr(0, 10)
+             << " to " << Date::fromDayNumber(rates.getLastDay()).toString().substr(0, 10) << "; re-valued " << foreign
+             << " foreign-currency transaction(s).\n";
+    }
+
+    // Stored amounts and rates are in the base currency, so once there are
+    // any a named base can no longer change (naming it the first time only
+    // labels them).
+    void setBaseCurrency(string code)
+    {
+        string normalized = Currency::normalize(code);
+        if (normalized.empty())
+        {
+            cout << "Error: Invalid currency code!\n";
+            return;
+        }
+        bool hasAmounts = !incomes.empty() || !expenses.empty() || !partitions.empty() || !coldBlocks.empty() || mapped ||
+                          !rules.empty() || !budgets.empty() || rates.listedRates() > 0;
+        if (!baseCurrency.empty() && normalized != baseCurrency && hasAmounts)
+        {
+            cout << "Error: Amounts and rates are already recorded in " << baseCurrency << "!\n";
+            return;
+        }
+        ChangeScope change(*this, "Set base currency to " + normalized);
+        writeCurrencies({normalized, reportCurrency, ratesText});
+        cout << "Base currency is now " << baseCurrency << ".\n";
+    }
+
+    // Blank or the base currency's code reports in the base currency.
+    void setReportCurrency(string code)
+    {
+        uint16_t id;
+        if (!resolveCurrency(code, id))
+        {
+            cout << "Error: Invalid currency code!\n";
+            return;
+        }
+        ChangeScope change(*this, "Set reporting currency to " + currencyName(id));
+        writeCurrencies({baseCurrency, id, ratesText});
+        cout << "Reports are now in " << currencyName(reportCurrency) << ".\n";
+    }
+
+    void viewRates() const
+    {
+        cout << "\n=== Currencies ===\n";
+        cout << "Base: " << currencyName(0) << " ,Reports: " << currencyName(reportCurrency) << "\n";
+        if (rates.listedRates() == 0)
+        {
+            cout << "No exchange rates loaded.\n";
+            return;
+        }
+        long long today = getCurrentDate().toDayNumber();
+        cout << "Rates on " << Date::fromDayNumber(today).toString().substr(0, 10) << " (per unit, in " << currencyName(0) << "):\n";
+        for (uint16_t id = 1; id < Currency::count(); ++id)
+            if (rates.hasRates(id)) cout << "- " << Currency::code(id) << ": " << fixed << setprecision(4) << rates.rate(id, today) << "\n";
+    }
+
+    // Out-of-core mode: totals, budgets, category details and period reports
+    // also read the rows of a mapped fixed-width ledger (see exportFixedWidth),
+    // whose budgets and rules come from its .settings file.
+    bool attachMapped(const string& filename)
+    {
+        unique_ptr<MappedLedger> ledger(new MappedLedger());
+        string error;
+        if (!ledger->open(filename, error))
+        {
+            cout << "Error: " << error << "!\n";
+            return false;
+        }
+        ifstream settings(filename + ".settings");
+        string line;
+        int lineNum = 0;
+        while (getline(settings, line)) loadRecord(line, ++lineNum);
+        cout << "Mapped " << filename << " (" << ledger->size() << " transactions, " << budgets.size()
+             << " budgets); changes made in this session are not saved.\n";
+        mapped = move(ledger);
+        return true;
+    }
+
+    // Writes every transaction as timestamp-sorted fixed-width rows for
+    // --mapped, and budgets and recurring rules to <file>.settings.
+    void exportFixedWidth(const string& filename)
+    {
+        ensureAllLoaded();
+        vector<MappedLedger::Row> rows;
+        rows.reserve(incomes.size() + expenses.size());
+        size_t truncated = 0;
+        auto add = [&](bool isIncome, const string& label, long long cents, long long ts)
+        {
+            rows.emplace_back();
+            if (!MappedLedger::encode(isIncome, label, cents, ts, rows.back())) truncated++;
+        };
+        for (const auto& inc : incomes) add(true, inc.getSource(), toCents(toBase(inc)), inc.getDate().toTimestamp());
+        for (const auto& exp : expenses) add(false, exp.getCategory(), toCents(toBase(exp)), exp.getDate().toTimestamp());
+        for (const auto& c : coldBlocks) c.second.forEachRow(add);
+        stable_sort(rows.begin(), rows.end(), [](const MappedLedger::Row& a, const MappedLedger::Row& b) { return a.ts < b.ts; });
+
+        ofstream out(filename, ios::binary | ios::trunc);
+        ofstream settings(filename + ".settings", ios::trunc);
+        if (!out.is_open() || !settings.is_open())
+        {
+            cout << "Error: Could not write " << filename << "!\n";
+            return;
+        }
+        out << MappedLedger::header();
+        out.write(reinterpret_cast<const char*>(rows.data()), rows.size() * sizeof(MappedLedger::Row));
+        settings << setprecision(15);
+        writeSettings(settings);
+        if (!out.good() || !settings.good())
+        {
+            cout << "Error: Could not write " << filename << "!\n";
+            return;
+        }
+        cout << "Exported " << rows.size() << " transactions to " << filename << " (open with --mapped " << filename << ")\n";
+        if (truncated > 0) cout << "Warning: " << truncated << " labels were cut to " << MappedLedger::maxLabel << " bytes.\n";
+    }
+
+    // Feeds writer.row every transaction in [fromTs, toTs], only expenses
+    // under `category` when one is given, tier by tier and unsorted. Hot
+    // rows keep their own currency; archived and mapped rows and recurring
+    // occurrences (up to now, as the totals count them) are in the base
+    // currency.
+    template <typename Writer>
+    size_t streamTransactions(Writer& writer, long long fromTs, long long toTs, const string& category)
+    {
+        static const string untagged;
+        const string* wanted = category.empty() ? nullptr : &category;
+        string tagText;
+        auto tagsOf = [&](const Transaction& t) -> const string&
+        {
+            if (t.getTags().empty()) return untagged;
+            tagText = joinTags(t.getTags());
+            return tagText;
+        };
+        auto currencyOf = [&](uint16_t id) -> const string& { return id == 0 ? baseCurrency : Currency::code(id); };
+
+        size_t count = 0;
+        if (!wanted)
+        {
+            for (const auto& inc : incomes)
+            {
+                long long ts = inc.getDate().toTimestamp();
+                if (ts < fromTs || ts > toTs) continue;
+                writer.row(true, inc.getSource(), toCents(inc.getAmount()), currencyOf(inc.getCurrency()), ts, tagsOf(inc));
+                count++;
+            }
+        }
+        for (const auto& exp : expenses)
+        {
+            long long ts = exp.getDate().toTimestamp();
+            if (ts < fromTs || ts > toTs || (wanted && !inCategory(exp.getCategory(), *wanted))) continue;
+            writer.row(false, exp.getCategory(), toCents(exp.getAmount()), currencyOf(exp.getCurrency()), ts, tagsOf(exp));
+            count++;
+        }
+        for (const auto& c : coldBlocks)
+        {
+            if (!c.second.overlaps(fromTs, toTs) || (wanted && !c.second.hasCategory(*wanted))) continue;
+            c.second.forEachTaggedRow([&](bool isIncome, const string& label, long long cents, long long ts, const string& tags)
+            {
+                if (ts < fromTs || ts > toTs || (wanted && (isIncome || !inCategory(label, *wanted)))) return;
+                writer.row(isIncome, label, cents, baseCurrency, ts, tags);
+                count++;
+            });
+        }
+        if (mapped)
+        {
+            mapped->scanRange(fromTs, toTs, [&](const MappedLedger::Row& r)
+            {
+                string label = MappedLedger::labelOf(r);
+                if (wanted && (r.isIncome || !inCategory(label, *wanted))) return;
+                writer.row(r.isIncome != 0, label, r.cents, baseCurrency, r.ts, untagged);
+                count++;
+            });
+        }
+        for (const auto& r : rules)
+        {
+            if (wanted && (r.isIncome() || !inCategory(r.getLabel(), *wanted))) continue;
+            long long cents = toCents(r.getAmount());
+            r.forEachOccurrence(fromTs, min(toTs, nowTimestamp()), [&](long long ts)
+            {
+                writer.row(r.isIncome(), r.getLabel(), cents, baseCurrency, ts, untagged);
+                count++;
+            });
+        }
+        return count;
+    }
+
+    // Streams transactions to JSON Lines or the columnar format, with the
+    // same date range and category filters as the reports.
+    void exportTransactions(const string& filename, ExportFormat format, Date start, Date end, string category)
+    {
+        if (start > end)
+        {
+            cout << "Error: The start date is newer than the end date! We will be swapping the dates.\n";
+            swap(start, end);
+        }
+        if (!category.empty())
+        {
+            category = normalizeCategory(category);
+            if (category.empty())
+            {
+                cout << "Error: Invalid category!\n";
+                return;
+            }
+        }
+        ensureRangeLoaded(start, end);
+
+        ExportBuffer out(filename);
+        if (!out.isOpen())
+        {
+            cout << "Error: Could not write " << filename << "!\n";
+            return;
+        }
+        chrono::steady_clock::time_point began = chrono::steady_clock::now();
+        size_t rows;
+        if (format == ExportFormat::JSON_LINES)
+        {
+            JsonLinesWriter writer(out);
+            rows = streamTransactions(writer, start.toTimestamp(), end.toTimestamp(), category);
+            writer.finish();
+        }
+        else
+        {
+            ColumnarWriter writer(out);
+            rows = streamTransactions(writer, start.toTimestamp(), end.toTimestamp(), category);
+            writer.finish();
+        }
+        unsigned long long bytes = out.bytes();
+        if (!out.close())
+        {
+            cout << "Error: Could not write " << filename << "!\n";
+            return;
+        }
+        double seconds = max(chrono::duration<double>(chrono::steady_clock::now() - began).count(), 1e-9);
+        cout << "Exported " << rows << " transactions to " << filename << " (" << fixed << setprecision(1) << bytes / 1048576.0
+             << " MB) in " << setprecision(3) << seconds << " s, " << setprecision(0) << rows / seconds << " rows/s\n";
+    }
+
+    // Memory per transaction and the net total of each storage tier.
+    void generateStorageReport()
+    {
+        ensureAllLoaded();
+        auto heapBytes = [](const string& s) { return s.capacity() > 15 ? s.capacity() + 1 : 0; };
+
+        size_t hotRows = incomes.size() + expenses.size();
+        size_t hotBytes = 0;
+        for (const auto& inc : incomes) hotBytes += sizeof(Income) + heapBytes(inc.getSource());
+        for (const auto& exp : expenses) hotBytes += sizeof(Expense) + heapBytes(exp.getCategory());
+
+        cout << "\n=== Storage Tiers ===\n" << fixed << setprecision(1);
+        cout << "Hot:  " << hotRows << " transactions, " << hotBytes << " bytes";
+        if (hotRows > 0) cout << " (" << static_cast<double>(hotBytes) / hotRows << " bytes/transaction), net "
+                                  << setprecision(2) << totalIncome - totalExpenses << setprecision(1);
+        cout << endl;
+        if (coldBlocks.empty())
+        {
+            cout << "Cold: nothing archived yet.\n";
+            return;
+        }
+        for (const auto& c : coldBlocks)
+        {
+            size_t rows = c.second.rowCount();
+            size_t bytes = c.second.memoryBytes();
+            long long total = c.second.getIncomeCents() - c.second.getExpenseCents();
+            cout << "Cold " << c.first << ": " << rows << " transactions, " << bytes << " bytes ("
+                 << static_cast<double>(bytes) / max<size_t>(rows, 1) << " bytes/transaction), net "
+                 << setprecision(2) << total / 100.0 << setprecision(1) << endl;
+        }
+    }
+
+    // Synchronous flush: hands any pending changes to the writer and waits for the disk.
+    void savePartitions()
+    {
+        if (dataDir.empty()) return;
+        size_t months = dirtyPartitions.size();
+        if (months > 0 || settingsDirty) takeSnapshot();
+        writer.waitIdle();
+        string error = writer.takeError();
+        if (!error.empty()) cout << "Error: " << error << "!\n";
+        else if (months > 0) cout << "Data saved to " << dataDir.string() << " (" << months << " month(s) rewritten)\n";
+    }
+
+    // Called between interactive commands; hands the command's changes to
+    // the writer, whose own timer decides when they reach the disk.
+    void tick()
+    {
+        string error = writer.takeError();
+        if (!error.empty()) cout << "Warning: Background save failed: " << error << endl;
+        if (dataDir.empty() || (dirtyPartitions.empty() && !settingsDirty)) return;
+        takeSnapshot(true);
+    }
+};
+
+
+int getValidatedInt(const string& prompt, int min = INT_MIN, int max = INT_MAX)
+{
+    string input;
+    int value;
+    while (true)
+    {
+        cout << prompt;
+        getline(cin, input);
+        if (isValidInt(input))
+        {
+            value = stoi(input);
+            if (value >= min && value <= max)
+                return value;
+            else
+                cout << "Please enter a number between " << min << " and " << max << ".\n";
+        }
+        else
+        {
+            cout << "Invalid input. Please enter a valid integer.\n";
+        }
+    }
+}
+
+
+double getValidatedDouble(const string& prompt, double min = 0)
+{
+    string input;
+    double value;
+    while (true)
+    {
+        cout << prompt;
+        getline(cin, input);
+        if (isValidDouble(input))
+        {
+            value = stod(input);
+            if (value >= min)
+                return value;
+            else
+                cout << "Please enter a number >= " << min << ".\n";
+        }
+        else
+        {
+            cout << "Invalid input. Please enter a valid number.\n";
+        }
+    }
+}
+
+
+string getValidatedString(const string& prompt)
+{
+    string input;
+    while (true)
+    {
+        cout << prompt;
+        getline(cin, input);
+        if (!input.empty())
+            return input;
+        else
+            cout << "Input cannot be empty. Please try again.\n";
+    }
+}
+
+// Benchmarks over synthetic in-memory ledgers: Project --bench <name> [rows]
+class LedgerBenchmark
+{
+private:
+    typedef chrono::steady_clock Clock;
+
+    static double secondsSince(Clock::time_point start)
+    {
+        return chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    static void fillSynthetic(FinanceTracker& tracker, size_t rows, unsigned seed)
+    {
+        static const char* categories[] = {"food", "rent", "travel", "utilities", "health", "fun",
+                                           "education", "clothes", "gifts", "transport", "insurance", "other"
+                                          };
+        static const char* sources[] = {"salary", "freelance", "interest", "gift"};
+        mt19937 rng(seed);
+        uniform_int_distribution<long long> day(Date(2020, 1, 1).toDayNumber(), Date(2026, 12, 31).toDayNumber());
+        uniform_int_distribution<int> sec(0, 86399);
+        uniform_real_distribution<double> amount(1, 1000);
+        for (size_t i = 0; i < rows; ++i)
+        {
+            Date dt = Date::fromTimestamp(day(rng) * 86400 + sec(rng));
+            double amt = static_cast<long long>(amount(rng) * 100) / 100.0;
+            if (i % 5 == 0) tracker.appendIncome(Income(sources[rng() % 4], amt * 5, dt));
+            else tracker.appendExpense(Expense(categories[rng() % 12], amt, dt));
+        }
+    }
+
+    static int filter(size_t rows)
+    {
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows, 42);
+        const string expression = "expense AND category IN (food, rent, travel) AND amount >= 50 AND amount < 500 "
+                                  "AND date >= 2024-01-01 AND date <= 2024-12-31";
+        const unordered_set<string> wanted = {"food", "rent", "travel"};
+        long long from = Date(2024, 1, 1).toTimestamp();
+        long long to = Date(2024, 12, 31, Time(23, 59, 59)).toTimestamp();
+
+        // Baseline: one pass per predicate, each narrowing an index list, then sum and count passes.
+        Clock::time_point start = Clock::now();
+        vector<size_t> stage;
+        for (size_t i = 0; i < tracker.expenses.size(); ++i)
+            if (wanted.count(tracker.expenses[i].getCategory())) stage.push_back(i);
+        vector<size_t> next;
+        for (size_t i : stage)
+        {
+            long long ts = tracker.expenses[i].getDate().toTimestamp();
+            if (ts >= from && ts <= to) next.push_back(i);
+        }
+        stage.swap(next);
+        next.clear();
+        for (size_t i : stage)
+        {
+            double amt = tracker.expenses[i].getAmount();
+            if (amt >= 50 && amt < 500) next.push_back(i);
+        }
+        double chainedSum = 0;
+        for (size_t i : next) chainedSum += tracker.expenses[i].getAmount();
+        size_t chainedCount = 0;
+        for (size_t i = 0; i < next.size(); ++i) ++chainedCount;
+        double chainedTime = secondsSince(start);
+
+        start = Clock::now();
+        TransactionFilter compiled(expression);
+        FilterScanResult serial = tracker.runFilter(compiled, true, false);
+        double fusedTime = secondsSince(start);
+
+        start = Clock::now();
+        FilterScanResult parallel = tracker.runFilter(compiled, true, true);
+        double parallelTime = secondsSince(start);
+
+        cout << "Rows: " << rows << " (" << tracker.expenses.size() << " expenses, " << tracker.incomes.size() << " incomes)\n";
+        cout << "Threads available: " << max(1u, thread::hardware_concurrency()) << endl;
+        cout << fixed << setprecision(3);
+        cout << "Chained single-predicate scans: " << chainedTime << " s, " << chainedCount << " rows, sum " << chainedSum << endl;
+        cout << "Fused compiled scan (serial):   " << fusedTime << " s, " << serial.expenseCount << " rows, sum " << serial.expenseSum << endl;
+        cout << "Fused compiled scan (parallel): " << parallelTime << " s, " << parallel.expenseCount << " rows, sum " << parallel.expenseSum << endl;
+        cout << "Speedup (serial fused vs chained): " << setprecision(2) << chainedTime / max(fusedTime, 1e-9) << "x\n";
+        return (serial.expenseCount == chainedCount && parallel.expenseCount == chainedCount) ? 0 : 1;
+    }
+
+    static int topN(size_t rows)
+    {
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows, 7);
+        vector<size_t> top, page, repeat;
+        cout << "Rows: " << rows << " (" << tracker.expenses.size() << " expenses)\n" << fixed << setprecision(3);
+
+        Clock::time_point start = Clock::now();
+        top = tracker.orderedSlice(tracker.expenses, nullptr, tracker.expenseOrders, SortKey::AMOUNT, true, 0, 10);
+        cout << "Top 10 by amount (heap selection): " << secondsSince(start) << " s\n";
+
+        start = Clock::now();
+        page = tracker.orderedSlice(tracker.expenses, nullptr, tracker.expenseOrders, SortKey::DATE, false,
+                                            tracker.expenses.size() / 2, tracker.expenses.size() / 2 + 50);
+        cout << "Middle page by date (full sort, cached): " << secondsSince(start) << " s\n";
+
+        start = Clock::now();
+        repeat = tracker.orderedSlice(tracker.expenses, nullptr, tracker.expenseOrders, SortKey::DATE, false,
+                                              tracker.expenses.size() / 2 + 50, tracker.expenses.size() / 2 + 100);
+        cout << "Next page by date (from cache): " << secondsSince(start) << " s\n";
+
+        for (size_t i = 1; i < top.size(); ++i)
+            if (tracker.expenses[top[i - 1]].getAmount() < tracker.expenses[top[i]].getAmount()) return 1;
+        return 0;
+    }
+
+    static int snapshot(size_t rows)
+    {
+        filesystem::path dir = filesystem::temp_directory_path() / "finance_bench_snapshot";
+        error_code ec;
+        filesystem::remove_all(dir, ec);
+        int rc = 0;
+        {
+            FinanceTracker tracker("");
+            tracker.dataDir = dir;
+            tracker.writer.setDirectory(dir);
+            fillSynthetic(tracker, rows, 3);
+            cout << "Rows: " << rows << ", dirty months: " << tracker.dirtyPartitions.size() << endl << fixed << setprecision(4);
+
+            Clock::time_point start = Clock::now();
+            tracker.takeSnapshot();
+            cout << "Main thread snapshot (all months dirty): " << secondsSince(start) << " s\n";
+
+            double worst = 0;
+            Date today = getCurrentDate();
+            for (int i = 0; i < 1000; ++i)
+            {
+                Clock::time_point op = Clock::now();
+                tracker.appendExpense(Expense("food", 1 + i % 50, today));
+                worst = max(worst, secondsSince(op));
+            }
+            cout << "Worst append latency while the save is in flight: " << worst * 1e6 << " us\n";
+
+            start = Clock::now();
+            tracker.takeSnapshot();
+            cout << "Main thread snapshot (one dirty month): " << secondsSince(start) << " s\n";
+            tracker.writer.waitIdle();
+            cout << "Background write finished " << secondsSince(start) << " s later\n";
+            if (!tracker.writer.takeError().empty()) rc = 1;
+        }
+        filesystem::remove_all(dir, ec);
+        return rc;
+    }
+
+    // A full scan of the hot rows and, per archived year, a full decode
+    // against reading the net total from the block's metadata.
+    static void timeTiers(const FinanceTracker& tracker)
+    {
+        volatile double sink = 0;
+        Clock::time_point start = Clock::now();
+        double sum = 0;
+        for (const auto& inc : tracker.incomes) sum += inc.getAmount() + inc.getDate().getDay();
+        for (const auto& exp : tracker.expenses) sum += exp.getAmount() + exp.getDate().getDay();
+        sink = sum;
+        cout << "Hot full scan: " << fixed << setprecision(1) << secondsSince(start) * 1000 << " ms\n";
+        for (const auto& c : tracker.coldBlocks)
+        {
+            start = Clock::now();
+            long long cents = 0;
+            c.second.forEachRow([&](bool, const string&, long long amount, long long ts) { cents += amount + ts % 7; });
+            sink = sink + cents;
+            double decode = secondsSince(start);
+            start = Clock::now();
+            sink = sink + (c.second.getIncomeCents() - c.second.getExpenseCents());
+            double summary = secondsSince(start);
+            cout << "Cold " << c.first << ": net from metadata in " << summary * 1e6 << " us, full decode "
+                 << decode * 1000 << " ms\n";
+        }
+    }
+
+    static int archive(size_t rows)
+    {
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows, 11);
+        double before = tracker.calculateTotalIncome() - tracker.calculateTotalExpenses();
+        double foodBefore = tracker.calculateSpentInCategory("food");
+        tracker.generateStorageReport();
+        timeTiers(tracker);
+
+        Clock::time_point start = Clock::now();
+        tracker.archiveYearsBefore(2026);
+        cout << "Archiving took " << fixed << setprecision(3) << secondsSince(start) << " s\n";
+        tracker.generateStorageReport();
+        timeTiers(tracker);
+
+        start = Clock::now();
+        double foodAfter = tracker.calculateSpentInCategory("food");
+        cout << "Category total across tiers (metadata only): " << setprecision(1) << secondsSince(start) * 1e6 << " us\n";
+        double after = tracker.calculateTotalIncome() - tracker.calculateTotalExpenses();
+        return (fabs(before - after) < 1 && fabs(foodBefore - foodAfter) < 1) ? 0 : 1;
+    }
+
+    // The file holds `rows` transactions, the first half of which are already in the ledger.
+    static int import(size_t rows)
+    {
+        filesystem::path file = filesystem::temp_directory_path() / "finance_bench_import.csv";
+        {
+            FinanceTracker source("");
+            fillSynthetic(source, rows, 5);
+            ofstream out(file);
+            out << setprecision(15);
+            for (const auto& inc : source.incomes) writeRecord(out, inc);
+            for (const auto& exp : source.expenses) writeRecord(out, exp);
+        }
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows / 2, 5);
+        size_t before = tracker.incomes.size() + tracker.expenses.size();
+        cout << "Ledger: " << before << " rows, file: " << rows << " rows\n" << fixed << setprecision(3);
+
+        Clock::time_point start = Clock::now();
+        ifstream in(file);
+        ImportResult merged = tracker.importRecords(in, DuplicatePolicy::MERGE);
+        double seconds = secondsSince(start);
+        cout << "Merge import: " << seconds << " s (" << setprecision(0) << rows / max(seconds, 1e-9) << " rows/s), "
+             << merged.imported << " added, " << merged.duplicates << " duplicates\n";
+
+        // Baseline: compare a sample of rows against every ledger row, then extrapolate.
+        start = Clock::now();
+        size_t sample = 200, found = 0;
+        for (size_t i = 0; i < sample; ++i)
+        {
+            const Expense& probe = tracker.expenses[i * 7919 % tracker.expenses.size()];
+            for (const auto& exp : tracker.expenses)
+            {
+                if (exp.getAmount() == probe.getAmount() && exp.getCategory() == probe.getCategory() &&
+                        exp.getDate().toTimestamp() == probe.getDate().toTimestamp())
+                {
+                    found++;
+                    break;
+                }
+            }
+        }
+        cout << "Pairwise comparison, extrapolated to the whole file: " << setprecision(0)
+             << secondsSince(start) / sample * rows << " s (" << found << "/" << sample << " sampled rows found)\n";
+
+        start = Clock::now();
+        ifstream again(file);
+        ImportResult skipped = tracker.importRecords(again, DuplicatePolicy::SKIP);
+        cout << "Re-import with skip: " << setprecision(3) << secondsSince(start) << " s, " << skipped.imported << " added\n";
+
+        error_code ec;
+        filesystem::remove(file, ec);
+        return (merged.duplicates == before && skipped.imported == 0 &&
+                tracker.incomes.size() + tracker.expenses.size() == rows) ? 0 : 1;
+    }
+
+    // A statement of `rows` lines: a fifth of them echo the ledger (one in ten
+    // of those a day late and a cent off, and one in ten ledger rows absent),
+    // the rest are dated after the ledger and can only be missing.
+    static int reconcile(size_t rows)
+    {
+        filesystem::path file = filesystem::temp_directory_path() / "finance_bench_statement.csv";
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows / 5, 13);
+        size_t written = 0, echoed = 0;
+        {
+            ofstream out(file);
+            out << fixed << setprecision(2);
+            auto echo = [&](long long cents, const Date& dt, const string& label)
+            {
+                if (written % 10 == 9)
+                {
+                    ++written;
+                    return;
+                }
+                long long ts = dt.toTimestamp();
+                if (written % 10 == 3)
+                {
+                    ts += 86400;
+                    cents += cents > 0 ? 1 : -1;
+                }
+                out << Date::fromTimestamp(ts).toString().substr(0, 10) << "," << cents / 100.0 << "," << label << "\n";
+                ++written;
+                ++echoed;
+            };
+            for (const auto& inc : tracker.incomes) echo(toCents(inc.getAmount()), inc.getDate(), inc.getSource());
+            for (const auto& exp : tracker.expenses) echo(-toCents(exp.getAmount()), exp.getDate(), exp.getCategory());
+            mt19937 rng(17);
+            uniform_int_distribution<long long> day(Date(2027, 1, 1).toDayNumber(), Date(2030, 12, 31).toDayNumber());
+            uniform_int_distribution<long long> cents(-100000, 100000);
+            for (size_t i = echoed; i < rows; ++i)
+                out << Date::fromDayNumber(day(rng)).toString().substr(0, 10) << "," << cents(rng) / 100.0 << ",bank\n";
+        }
+        size_t threads = max(1u, thread::hardware_concurrency());
+        cout << "Ledger: " << tracker.incomes.size() + tracker.expenses.size() << " rows, statement: " << rows
+             << " rows, threads: " << threads << endl << fixed << setprecision(3);
+
+        StatementSorter statement(filesystem::temp_directory_path() / "finance_bench_runs");
+        Clock::time_point start = Clock::now();
+        bool ok = statement.sortFile(file.string(), 1 << 20, threads);
+        double sortTime = secondsSince(start);
+        cout << "Sort phase: " << sortTime << " s, " << statement.runCount() << " runs\n";
+
+        start = Clock::now();
+        ostringstream unmatched;
+        unmatched.setstate(ios::badbit);
+        ReconcileSummary s = tracker.reconcile(statement, 1, 1, unmatched);
+        double mergeTime = secondsSince(start);
+        cout << "Merge-join: " << mergeTime << " s\n";
+        cout << "Throughput: " << setprecision(0) << rows / max(sortTime + mergeTime, 1e-9) << " statement rows/s\n";
+        cout << "Matched " << s.matched << " (" << s.inexact << " inexact), missing " << s.missing << ", extra " << s.extra << endl;
+
+        error_code ec;
+        filesystem::remove(file, ec);
+        size_t ledgerRows = tracker.incomes.size() + tracker.expenses.size();
+        return (ok && s.complete && s.matched + s.missing == rows && s.matched + s.extra == ledgerRows && s.matched >= echoed * 99 / 100) ? 0 : 1;
+    }
+
+    static int tags(size_t rows)
+    {
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows, 23);
+        static const char* names[] = {"trip-2026", "reimbursable", "tax-deductible", "personal"};
+        static const int percent[] = {2, 10, 25, 50};
+        mt19937 rng(29);
+        for (auto& exp : tracker.expenses)
+        {
+            vector<string> t;
+            for (int k = 0; k < 4; ++k)
+                if (static_cast<int>(rng() % 100) < percent[k]) t.push_back(names[k]);
+            exp.setTags(t);
+        }
+        tracker.expenseTags.invalidate();
+        Clock::time_point start = Clock::now();
+        tracker.expenseTags.refresh(tracker.expenses);
+        cout << "Rows: " << rows << " (" << tracker.expenses.size() << " expenses)\n" << fixed << setprecision(3);
+        cout << "Bitmap build: " << secondsSince(start) << " s\n";
+        size_t bytes = 0;
+        for (const auto& b : tracker.expenseTags.all()) bytes += b.second.memoryBytes();
+        cout << "Bitmap memory: " << bytes << " bytes (" << setprecision(2)
+             << static_cast<double>(bytes) * 8 / max<size_t>(tracker.expenses.size(), 1) << " bits/row)\n";
+
+        int rc = 0;
+        for (const string text : {"trip-2026 AND reimbursable", "reimbursable AND tax-deductible AND NOT personal",
+                                  "trip-2026 OR reimbursable", "NOT personal"})
+        {
+            TagQuery query(text);
+            start = Clock::now();
+            size_t scanCount = 0;
+            double scanSum = 0;
+            for (const auto& exp : tracker.expenses)
+            {
+                if (!query.matches(exp.getTags())) continue;
+                scanCount++;
+                scanSum += exp.getAmount();
+            }
+            double scanTime = secondsSince(start);
+
+            start = Clock::now();
+            FilterScanResult r = tracker.runTagQuery(query, false);
+            double bitmapTime = secondsSince(start);
+            cout << setprecision(3) << "\"" << text << "\": " << r.expenseCount << " rows, row scan " << scanTime
+                 << " s, bitmaps " << bitmapTime << " s (" << setprecision(1) << scanTime / max(bitmapTime, 1e-9) << "x)\n";
+            if (r.expenseCount != scanCount || fabs(r.expenseSum - scanSum) > 0.01) rc = 1;
+        }
+        return rc;
+    }
+
+    // Per-category median and p95 from the running statistics versus an exact
+    // sort of each category's amounts.
+    static int stats(size_t rows)
+    {
+        FinanceTracker tracker("");
+        Clock::time_point start = Clock::now();
+        fillSynthetic(tracker, rows, 31);
+        cout << "Rows: " << rows << " (" << tracker.expenses.size() << " expenses)\n" << fixed << setprecision(3);
+        cout << "Insert with statistics: " << secondsSince(start) << " s\n";
+
+        start = Clock::now();
+        map<string, vector<double>> amounts;
+        for (const auto& exp : tracker.expenses) amounts[exp.getCategory()].push_back(exp.getAmount());
+        map<string, pair<double, double>> exact;
+        for (auto& a : amounts)
+        {
+            vector<double>& v = a.second;
+            sort(v.begin(), v.end());
+            exact[a.first] = make_pair(v[static_cast<size_t>(0.5 * (v.size() - 1))], v[static_cast<size_t>(0.95 * (v.size() - 1))]);
+        }
+        double sortTime = secondsSince(start);
+
+        start = Clock::now();
+        map<string, pair<double, double>> sketched;
+        for (const auto& a : amounts)
+        {
+            const AmountStats& s = tracker.expenseStats.at(a.first);
+            sketched[a.first] = make_pair(s.quantile(0.5), s.quantile(0.95));
+        }
+        double sketchTime = secondsSince(start);
+
+        double worst = 0;
+        for (const auto& e : exact)
+        {
+            const pair<double, double>& s = sketched[e.first];
+            worst = max(worst, fabs(s.first - e.second.first) / max(e.second.first, 0.01));
+            worst = max(worst, fabs(s.second - e.second.second) / max(e.second.second, 0.01));
+        }
+        cout << "Median and p95 of " << exact.size() << " categories: exact sort " << sortTime << " s, statistics "
+             << setprecision(6) << sketchTime << " s\n";
+        cout << "Worst relative error: " << setprecision(3) << worst * 100 << "%\n";
+        return worst <= 0.011 ? 0 : 1;
+    }
+
+    // Times a forecast from the incrementally kept rate model, its cached
+    // repeat, and a recompute after one edit, against re-deriving the
+    // spending rate by scanning every row.
+    static int forecast(size_t rows)
+    {
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows, 43);
+        tracker.setBudget("food", 5000, BudgetPeriod::MONTHLY);
+        tracker.setBudget("travel", 40000, BudgetPeriod::ALL_TIME);
+        tracker.setBudget("fun", 2000, BudgetPeriod::ROLLING_DAYS, 30);
+        cout << "Rows: " << rows << "\n" << fixed << setprecision(6);
+
+        long long today = getCurrentDate().toDayNumber();
+        Clock::time_point start = Clock::now();
+        long long firstDay = LLONG_MAX;
+        for (const auto& inc : tracker.incomes) firstDay = min(firstDay, inc.getDate().toDayNumber());
+        for (const auto& exp : tracker.expenses) firstDay = min(firstDay, exp.getDate().toDayNumber());
+        long long history = today - firstDay + 1;
+        double scanned = 0;
+        const long long windows[] = {30, 90, 365};
+        const double weights[] = {0.5, 0.3, 0.2};
+        for (int w = 0; w < 3; ++w)
+        {
+            long long days = min(windows[w], history);
+            double sum = 0;
+            for (const auto& exp : tracker.expenses)
+            {
+                long long d = exp.getDate().toDayNumber();
+                if (d > today - days && d <= today) sum += exp.getAmount();
+            }
+            scanned += weights[w] * sum / days;
+        }
+        double scanTime = secondsSince(start);
+
+        start = Clock::now();
+        const CashFlowForecast& first = tracker.forecast(365);
+        double firstTime = secondsSince(start);
+        double rate = first.expenseRate;
+
+        const int repeats = 1000;
+        start = Clock::now();
+        for (int i = 0; i < repeats; ++i) tracker.forecast(1 + i % 365);
+        double cachedTime = secondsSince(start) / repeats;
+
+        tracker.appendExpense(Expense("food", 12.5, getCurrentDate()));
+        start = Clock::now();
+        tracker.forecast(365);
+        double editTime = secondsSince(start);
+
+        cout << "Spending rate by scanning every row: " << scanTime << " s\n";
+        cout << "Forecast (365 days, 3 budgets) from the model: " << firstTime << " s\n";
+        cout << "Cached repeat: " << setprecision(9) << cachedTime << " s\n" << setprecision(6);
+        cout << "After one new expense: " << editTime << " s\n";
+        cout << "Daily spending rate: " << setprecision(4) << rate << " (scan " << scanned << ")\n";
+        return fabs(rate - scanned) <= 1e-6 * max(1.0, scanned) ? 0 : 1;
+    }
+
+    // Regression check: undo after a restart must only take back the new
+    // row, not the rows its month load read from disk.
+    static int undoAfterRestart(size_t)
+    {
+        filesystem::path dir = filesystem::temp_directory_path() / "finance_bench_undo";
+        error_code ec;
+        filesystem::remove_all(dir, ec);
+        filesystem::create_directories(dir, ec);
+        string file = (dir / "ledger.csv").string();
+        {
+            FinanceTracker tracker(file);
+            tracker.addIncome(100, Date(2025, 1, 15, Time(12, 0, 0)), "salary");
+        }
+        size_t edits = 0;
+        {
+            FinanceTracker tracker(file);
+            tracker.addIncome(50, Date(2025, 1, 20, Time(12, 0, 0)), "gift");
+            if (!tracker.undoHistory.empty()) edits = tracker.undoHistory.back().size();
+            tracker.undo();
+        }
+        size_t left = 0;
+        double total = 0;
+        {
+            FinanceTracker tracker(file);
+            tracker.ensureAllLoaded();
+            left = tracker.incomes.size();
+            total = tracker.calculateTotalIncome();
+        }
+        filesystem::remove_all(dir, ec);
+        bool ok = edits == 1 && left == 1 && fabs(total - 100) < 0.005;
+        cout << "Undo after restart: " << edits << " edit(s) logged, " << left << " income(s) kept, total "
+             << fixed << setprecision(2) << total << (ok ? " (ok)" : " (WRONG)") << "\n";
+        return ok ? 0 : 1;
+    }
+
+    // Streams the whole ledger to both export formats, sampling resident
+    // memory, then reads the columnar file back and checks the totals.
+    static int exportRows(size_t rows)
+    {
+        FinanceTracker tracker("");
+        fillSynthetic(tracker, rows, 44);
+        long long incomeCents = 0, expenseCents = 0;
+        for (const auto& inc : tracker.incomes) incomeCents += toCents(inc.getAmount());
+        for (const auto& exp : tracker.expenses) expenseCents += toCents(exp.getAmount());
+        cout << "Rows: " << rows << "\n" << fixed;
+
+        filesystem::path dir = filesystem::temp_directory_path();
+        filesystem::path jsonFile = dir / "finance_bench_export.jsonl";
+        filesystem::path columnFile = dir / "finance_bench_export.ftcol";
+        Date start(1900, 1, 1, Time(0, 0, 0)), end(9999, 12, 31, Time(23, 59, 59));
+        for (ExportFormat format : {ExportFormat::JSON_LINES, ExportFormat::COLUMNAR})
+        {
+            size_t before = residentBytes();
+            tracker.exportTransactions((format == ExportFormat::JSON_LINES ? jsonFile : columnFile).string(), format, start, end, "");
+            size_t after = residentBytes();
+            cout << "  resident growth " << setprecision(1) << (after > before ? after - before : 0) / 1048576.0 << " MB\n";
+        }
+
+        int rc = 0;
+        ifstream in(columnFile, ios::binary);
+        char magic[8];
+        uint32_t columns = 0;
+        in.read(magic, 8);
+        in.read(reinterpret_cast<char*>(&columns), 4);
+        for (uint32_t c = 0; c < columns; ++c)
+        {
+            uint8_t type, length;
+            in.read(reinterpret_cast<char*>(&type), 1);
+            in.read(reinterpret_cast<char*>(&length), 1);
+            in.ignore(length);
+        }
+        long long readIncome = 0, readExpense = 0;
+        unsigned long long readRows = 0, trailer = 0;
+        uint32_t groupSize = 0;
+        while (in.read(reinterpret_cast<char*>(&groupSize), 4) && groupSize > 0)
+        {
+            vector<vector<char>> data(columns);
+            for (auto& column : data)
+            {
+                uint64_t length;
+                in.read(reinterpret_cast<char*>(&length), 8);
+                column.resize(length);
+                in.read(column.data(), length);
+            }
+            const uint8_t* types = reinterpret_cast<const uint8_t*>(data[1].data());
+            const int64_t* amounts = reinterpret_cast<const int64_t*>(data[2].data());
+            for (uint32_t i = 0; i < groupSize; ++i) (types[i] ? readIncome : readExpense) += amounts[i];
+            readRows += groupSize;
+        }
+        in.read(reinterpret_cast<char*>(&trailer), 8);
+        if (memcmp(magic, "FTCOL1", 6) != 0 || readRows != rows || trailer != rows || readIncome != incomeCents ||
+                readExpense != expenseCents) rc = 1;
+        cout << "Columnar read-back: " << readRows << " rows, totals " << (rc == 0 ? "match" : "DIFFER") << "\n";
+        filesystem::remove(jsonFile);
+        filesystem::remove(columnFile);
+        return rc;
+    }
+
+    static size_t residentBytes()
+    {
+        ifstream statm("/proc/self/statm");
+        size_t total = 0, resident = 0;
+        statm >> total >> resident;
+        return resident * 4096;
+    }
+
+    // Converts mixed-currency rows into one reporting currency, first with a
+    // per-row rate lookup in ordered maps and then through ConversionBatch.
+    static int currency(size_t rows)
+    {
+        static const char* codes[] = {"EUR", "GBP", "JPY", "CHF", "CAD"};
+        mt19937 rng(41);
+        long long firstDay = Date(2015, 1, 1).toDayNumber();
+        long long spanDays = 10 * 365;
+        stringstream rateFile;
+        vector<map<long long, double>> points(6);
+        for (int c = 0; c < 5; ++c)
+        {
+            double rate = c == 2 ? 0.009 : 1.1;
+            for (long long d = 0; d < spanDays; d += 1 + rng() % 3)
+            {
+                rate *= 1 + (static_cast<int>(rng() % 2001) - 1000) / 200000.0;
+                rateFile << Date::fromDayNumber(firstDay + d).toString().substr(0, 10) << "," << codes[c] << "," << setprecision(10) << rate << "\n";
+            }
+        }
+        RateTable rates;
+        string error;
+        Clock::time_point start = Clock::now();
+        if (!RateTable::parse(rateFile, rates, error))
+        {
+            cout << "Error: " << error << "\n";
+            return 1;
+        }
+        cout << "Rates: " << rates.listedRates() << " listed, parsed in " << fixed << setprecision(3) << secondsSince(start) << " s\n";
+        vector<uint16_t> ids(6, 0);
+        for (int c = 0; c < 5; ++c) ids[c + 1] = Currency::intern(codes[c]);
+        rateFile.clear();
+        rateFile.seekg(0);
+        string line;
+        while (getline(rateFile, line))
+        {
+            int y, m, d;
+            sscanf(line.c_str(), "%d-%d-%d", &y, &m, &d);
+            string code = line.substr(11, 3);
+            for (int c = 0; c < 5; ++c)
+                if (code == codes[c]) points[c + 1][Date(y, m, d).toDayNumber()] = stod(line.substr(15));
+        }
+
+        struct Row
+        {
+            double amount;
+            uint16_t currency;
+            long long day;
+        };
+        vector<Row> data(rows);
+        for (auto& r : data)
+        {
+            r.amount = (100 + rng() % 100000) / 100.0;
+            r.currency = ids[rng() % 6];
+            r.day = firstDay + rng() % spanDays;
+        }
+        uint16_t to = ids[1];
+        cout << "Rows: " << rows << " over " << Currency::count() - 1 << " foreign currencies, reporting in " << Currency::code(to) << "\n";
+
+        auto lookup = [&](uint16_t id, long long day) -> double
+        {
+            int c = 0;
+            while (c < 6 && ids[c] != id) ++c;
+            if (c == 0) return 1;
+            auto it = points[c].upper_bound(day);
+            return it == points[c].begin() ? it->second : prev(it)->second;
+        };
+        start = Clock::now();
+        double naive = 0;
+        for (const auto& r : data) naive += r.amount * lookup(r.currency, r.day) / lookup(to, r.day);
+        double naiveTime = secondsSince(start);
+
+        start = Clock::now();
+        ConversionBatch batch(rates, to);
+        for (const auto& r : data) batch.add(r.amount, r.currency, r.day);
+        double batched = batch.sum();
+        double batchTime = secondsSince(start);
+
+        cout << "Per-row lookup: " << setprecision(3) << naiveTime << " s (" << setprecision(0) << rows / naiveTime << " rows/s)\n";
+        cout << "Batched:        " << setprecision(3) << batchTime << " s (" << setprecision(0) << rows / batchTime << " rows/s), "
+             << setprecision(1) << naiveTime / batchTime << "x\n";
+        double drift = fabs(naive - batched) / max(1.0, fabs(naive));
+        cout << "Totals: " << setprecision(2) << naive << " vs " << batched << " (relative difference " << scientific << setprecision(1)
+             << drift << ")\n" << fixed;
+        return drift < 1e-9 ? 0 : 1;
+    }
+
+    // Writes a fixed-width ledger larger than the scan window, maps it and
+    // runs the report aggregates over it while sampling resident memory.
+    static int mapped(size_t rows)
+    {
+        static const char* categories[] = {"food", "food/groceries", "rent", "travel", "utilities", "fun"};
+        filesystem::path file = filesystem::temp_directory_path() / "finance_bench_mapped.fw";
+        mt19937 rng(37);
+        long long ts = Date(2000, 1, 1).toTimestamp();
+        long long incomeCents = 0, expenseCents = 0, foodCents = 0;
+        Clock::time_point start = Clock::now();
+        {
+            ofstream out(file, ios::binary | ios::trunc);
+            out << MappedLedger::header();
+            vector<MappedLedger::Row> block(1 << 16);
+            for (size_t done = 0; done < rows;)
+            {
+                size_t n = min(block.size(), rows - done);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ts += rng() % 60;
+                    bool isIncome = (done + i) % 5 == 0;
+                    long long cents = 100 + rng() % 100000;
+                    const char* label = isIncome ? "salary" : categories[rng() % 6];
+                    MappedLedger::encode(isIncome, label, cents, ts, block[i]);
+                    (isIncome ? incomeCents : expenseCents) += cents;
+                    if (!isIncome && inCategory(label, "food")) foodCents += cents;
+                }
+                out.write(reinterpret_cast<const char*>(block.data()), n * sizeof(MappedLedger::Row));
+                done += n;
+            }
+        }
+        double fileMb = filesystem::file_size(file) / 1048576.0;
+        cout << "Rows: " << rows << " (" << fixed << setprecision(0) << fileMb << " MB file, written in "
+             << setprecision(2) << secondsSince(start) << " s)\n";
+
+        int rc = 0;
+        {
+            FinanceTracker tracker("");
+            size_t before = residentBytes();
+            start = Clock::now();
+            if (!tracker.attachMapped(file.string())) return 1;
+            cout << "Open: " << setprecision(1) << secondsSince(start) * 1e6 << " us\n";
+
+            size_t peak = 0;
+            size_t seen = 0;
+            start = Clock::now();
+            long long net = 0;
+            tracker.mapped->scan(0, tracker.mapped->size(), [&](const MappedLedger::Row& r)
+            {
+                net += r.isIncome ? r.cents : -r.cents;
+                if (++seen % 100000 == 0) peak = max(peak, residentBytes());
+            });
+            double scan = secondsSince(start);
+            cout << "Full scan: " << setprecision(2) << scan << " s (" << setprecision(0) << rows / scan << " rows/s), resident growth "
+                 << setprecision(1) << (peak > before ? peak - before : 0) / 1048576.0 << " MB peak\n";
+
+            start = Clock::now();
+            double income = tracker.calculateTotalIncome();
+            double expense = tracker.calculateTotalExpenses();
+            double summary = secondsSince(start);
+            start = Clock::now();
+            double food = tracker.calculateSpentInCategory("food");
+            double category = secondsSince(start);
+            start = Clock::now();
+            long long lastDay = ts / 86400;
+            double month = tracker.calculateSpentInCategory("food", lastDay - 29, lastDay);
+            double range = secondsSince(start);
+            cout << setprecision(3) << "Summary " << summary << " s, category " << category << " s, last 30 days of food "
+                 << setprecision(6) << range << " s (" << setprecision(2) << month << ")\n";
+            if (toCents(income) != incomeCents || toCents(expense) != expenseCents || toCents(food) != foodCents ||
+                    net != incomeCents - expenseCents) rc = 1;
+        }
+        filesystem::remove(file);
+        filesystem::remove(file.string() + ".settings");
+        return rc;
+    }
+
+public:
+    static int run(const string& name, size_t rows)
+    {
+        if (name == "undo") return undoAfterRestart(rows);
+        if (name == "export") return exportRows(rows ? rows : 2000000);
+        if (name == "forecast") return forecast(rows ? rows : 2000000);
+        if (name == "currency") return currency(rows ? rows : 10000000);
+        if (name == "mapped") return mapped(rows ? rows : 20000000);
+        if (name == "stats") return stats(rows ? rows : 2000000);
+        if (name == "tags") return tags(rows ? rows : 2000000);
+        if (name == "reconcile") return reconcile(rows ? rows : 10000000);
+        if (name == "import") return import(rows ? rows : 5000000);
+        if (name == "archive") return archive(rows ? rows : 2000000);
+        if (name == "snapshot") return snapshot(rows ? rows : 2000000);
+        if (name == "filter") return filter(rows ? rows : 2000000);
+        if (name == "topn") return topN(rows ? rows : 2000000);
+        cout << "Unknown benchmark: " << name << "\n";
+        cout << "Available: filter, topn, snapshot, archive, import, reconcile, tags, stats, mapped, currency, forecast, export, undo\n";
+        return 1;
+    }
+};
+
+#ifdef __linux__
+// Serves read queries and appends over a Unix domain socket (or 127.0.0.1
+// when the address is a port number). Each worker thread runs its own epoll
+// loop; requests are newline-terminated and may be pipelined, and responses
+// come back in order, one line each ("OK ..." or "ERR ...").
+//
+//   PING                                   OK PONG
+//   TOTALS                                 OK <income> <expenses> <balance>
+//   BALANCE [YYYY-MM-DD]                   OK <balance at the end of that day>
+//   SPENT <category>                       OK <spent, subcategories included>
+//   BUDGETS                                OK <category>:<limit>:<spent>;...
+//   STATS <category>                       OK <count> <mean> <median> <p95>
+//   ADD INCOME|EXPENSE <amount> <YYYY-MM-DD|now> <label>   OK
+//   QUIT                                   (connection closes)
+//
+// Reads share a reader lock, so every loop answers them concurrently; an
+// ADD takes the writer lock for the batch it arrives in.
+class LedgerServer
+{
+private:
+    struct Connection
+    {
+        int fd;
+        string in;
+        string out;
+        bool closing = false;
+    };
+
+    static const size_t maxLineBytes = 64 * 1024;
+    static int stopFd;
+
+    FinanceTracker& tracker;
+    shared_mutex ledgerLock;
+    int listenFd = -1;
+    atomic<unsigned long long> requests{0};
+
+    static void onSignal(int)
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(stopFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    static string money(double amount)
+    {
+        ostringstream out;
+        out << fixed << setprecision(2) << amount;
+        return out.str();
+    }
+
+    static bool parseDay(const string& text, Date& dt)
+    {
+        int y, m, d;
+        char extra;
+        if (sscanf(text.c_str(), "%d-%d-%d%c", &y, &m, &d, &extra) != 3) return false;
+        if (y < 1900 || y > 9999 || m < 1 || m > 12 || d < 1 || d > Date::daysInMonth(y, m)) return false;
+        dt = Date(y, m, d, Time(23, 59, 59));
+        return true;
+    }
+
+    // FORECAST counts as a write because it may refill the tracker's cache.
+    static bool isWrite(const string& line)
+    {
+        return line.compare(0, 4, "ADD ") == 0 || line.compare(0, 8, "FORECAST") == 0;
+    }
+
+    string handle(const string& line)
+    {
+        istringstream in(line);
+        string command;
+        in >> command;
+        string rest;
+        getline(in >> ws, rest);
+
+        if (command == "PING") return "OK PONG";
+        if (command == "TOTALS")
+        {
+            double income = tracker.calculateTotalIncome();
+            double spent = tracker.calculateTotalExpenses();
+            return "OK " + money(income) + " " + money(spent) + " " + money(income - spent);
+        }
+        if (command == "BALANCE")
+        {
+            Date dt = getCurrentDate();
+            if (!rest.empty() && !parseDay(rest, dt)) return "ERR invalid date";
+            return "OK " + money(tracker.calculateBalanceAt(dt));
         }
-        cout << "\nTransactions from " << start.toString() << " to " << end.toString() << ":\n";
-        cout << "\nYour Incomes:\n";
-        bool foundIncome = false;
-        for (size_t i = 0; i < incomes.size(); ++i)
+        if (command == "SPENT")
         {
-            if (incomes[i].getDate() >= start && incomes[i].getDate() <= end)
-            {
-                incomes[i].viewTrans();
-                foundIncome = true;
-            }
+            string category = normalizeCategory(rest);
+            if (category.empty()) return "ERR missing category";
+            return "OK " + money(tracker.calculateSpentInCategory(category));
         }
-        if (!foundIncome) cout << "No incomes in this period.\n";
-
-        cout << "\nYour Expenses:\n";
-        bool foundExpense = false;
-        for (size_t i = 0; i < expenses.size(); ++i)
+        if (command == "BUDGETS")
         {
-            if (expenses[i].getDate() >= start && expenses[i].getDate() <= end)
+            string result = "OK";
+            for (size_t i = 0; i < tracker.budgets.size(); ++i)
             {
-                expenses[i].viewTrans();
-                foundExpense = true;
+                const Budget& b = tracker.budgets[i];
+                result += i == 0 ? " " : ";";
+                result += b.getCategory() + ":" + money(b.getAmount()) + ":" + money(tracker.calculateSpentForBudget(b));
             }
+            return result;
         }
-        if (!foundExpense) cout << "No expenses in this period.\n";
-    }
-
-    void saveToFile(string filename) const
-    {
-        ofstream file(filename);
-        if (!file.is_open())
-        {
-            cout << "Error opening file for saving!\n";
-            return;
-        }
-        for (const auto& inc : incomes)
+        if (command == "STATS")
         {
-            file << "INCOME," << inc.getSource() << "," << inc.getAmount() << "," << inc.getDate().toString() << "\n";
+            auto it = tracker.expenseStats.find(normalizeCategory(rest));
+            if (it == tracker.expenseStats.end()) return "OK 0 0.00 0.00 0.00";
+            const AmountStats& s = it->second;
+            return "OK " + to_string(s.getCount()) + " " + money(s.getMean()) + " " + money(s.quantile(0.5)) + " " +
+                   money(s.quantile(0.95));
         }
-        for (const auto& exp : expenses)
+        if (command == "FORECAST")
         {
-            file << "EXPENSE," << exp.getCategory() << "," << exp.getAmount() << "," << exp.getDate().toString() << "\n";
+            int days = 90;
+            if (!rest.empty() && (!isValidInt(rest) || (days = stoi(rest)) < 1 || days > FinanceTracker::maxForecastDays))
+                return "ERR invalid horizon";
+            const CashFlowForecast& f = tracker.forecast(days);
+            string negative = "NONE";
+            for (int i = 0; i < days; ++i)
+            {
+                if (f.balance[i] >= 0) continue;
+                negative = Date::fromDayNumber(f.today + 1 + i).toString().substr(0, 10);
+                break;
+            }
+            return "OK " + money(f.balance[days - 1]) + " " + negative;
         }
-        for (const auto& b : budgets)
+        if (command == "ADD")
         {
-            file << "BUDGET," << b.getCategory() << "," << b.getAmount() << "\n";
+            istringstream args(rest);
+            string type, amountText, dateText, label;
+            args >> type >> amountText >> dateText;
+            getline(args >> ws, label);
+            Date dt = getCurrentDate();
+            if (type != "INCOME" && type != "EXPENSE") return "ERR type must be INCOME or EXPENSE";
+            if (!isValidDouble(amountText) || stod(amountText) < 0) return "ERR invalid amount";
+            if (dateText != "now" && !parseDay(dateText, dt)) return "ERR invalid date";
+            if (type == "EXPENSE") label = normalizeCategory(label);
+            if (label.empty()) return "ERR missing label";
+            if (type == "INCOME") tracker.appendIncome(Income(label, stod(amountText), dt));
+            else tracker.appendExpense(Expense(label, stod(amountText), dt));
+            return "OK";
         }
-        file.close();
-        cout << "Data saved to " << filename << endl;
+        return "ERR unknown command";
     }
 
-    void loadFromFile(string filename)
+    // Answers every complete line in the buffer, taking the lock once per batch.
+    void process(Connection& c)
     {
-        ifstream file(filename);
-        if (!file.is_open())
+        vector<string> lines;
+        size_t start = 0;
+        for (size_t nl = c.in.find('\n'); nl != string::npos; nl = c.in.find('\n', start))
         {
-            cout << "No save file foundstarting fresh.\n";
+            string line = c.in.substr(start, nl - start);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            lines.push_back(line);
+            start = nl + 1;
+        }
+        c.in.erase(0, start);
+        if (c.in.size() > maxLineBytes)
+        {
+            c.out += "ERR request too long\n";
+            c.closing = true;
             return;
         }
+        if (lines.empty()) return;
 
-        string line;
-        int lineNum = 0;
-        while (getline(file, line))
+        bool writes = any_of(lines.begin(), lines.end(), isWrite);
+        unique_lock<shared_mutex> writer(ledgerLock, defer_lock);
+        shared_lock<shared_mutex> reader(ledgerLock, defer_lock);
+        if (writes) writer.lock();
+        else reader.lock();
+        for (const auto& line : lines)
         {
-            lineNum++;
+            if (line == "QUIT")
+            {
+                c.closing = true;
+                break;
+            }
             if (line.empty()) continue;
+            c.out += handle(line);
+            c.out += '\n';
+        }
+        requests += lines.size();
+    }
 
-            stringstream ss(line);
-            string type, field1, field2, field3;
-
-            getline(ss, type, ',');
-            getline(ss, field1, ',');
-            getline(ss, field2, ',');
-            getline(ss, field3);
+    // False once the peer is gone.
+    static bool flushOutput(Connection& c)
+    {
+        while (!c.out.empty())
+        {
+            ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+            c.out.erase(0, n);
+        }
+        return !c.closing;
+    }
 
-            if (type.empty() || field1.empty()) continue;
+    void loop(bool saver)
+    {
+        int ep = epoll_create1(0);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = nullptr;
+        epoll_ctl(ep, EPOLL_CTL_ADD, listenFd, &ev);
+        static int stopMarker;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &stopMarker;
+        epoll_ctl(ep, EPOLL_CTL_ADD, stopFd, &ev);
 
-            if (type == "BUDGET")
+        map<int, unique_ptr<Connection>> connections;
+        epoll_event events[64];
+        bool stopping = false;
+        chrono::steady_clock::time_point lastTick = chrono::steady_clock::now();
+        while (!stopping)
+        {
+            int n = epoll_wait(ep, events, 64, 1000);
+            // One loop drives the background saver, about once a second.
+            if (saver && chrono::steady_clock::now() - lastTick >= chrono::seconds(1))
             {
-                // Format: BUDGET,category,amount
-                try
-                {
-                    double amt = stod(field2);
-                    budgets.push_back(Budget(field1, amt));
-                }
-                catch (...)
-                {
-                    cout << "Warning: Invalid budget on line " << lineNum << ", skipping.\n";
-                }
+                unique_lock<shared_mutex> writer(ledgerLock);
+                tracker.tick();
+                lastTick = chrono::steady_clock::now();
             }
-            else if (type == "INCOME" || type == "EXPENSE")
+            for (int i = 0; i < n; ++i)
             {
-                // Format: INCOME,source,amount,date
-                // Format: EXPENSE,category,amount,date
-                string category_or_source = field1;
-                double amt;
-                try
+                if (events[i].data.ptr == &stopMarker)
                 {
-                    amt = stod(field2);
+                    stopping = true;
+                    continue;
                 }
-                catch (...)
+                if (events[i].data.ptr == nullptr)
                 {
-                    cout << "Warning: Invalid amount on line " << lineNum << ", skipping.\n";
+                    int fd;
+                    while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+                    {
+                        unique_ptr<Connection> c(new Connection());
+                        c->fd = fd;
+                        epoll_event cev{};
+                        cev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                        cev.data.ptr = c.get();
+                        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &cev);
+                        connections[fd] = move(c);
+                    }
                     continue;
                 }
 
-                // format is "YYYY-MM-DD HH:MM:SS"
-                int y = 2000, m = 1, d = 1, h = 0, min = 0, sec = 0;
-                sscanf(field3.c_str(), "%d-%d-%d %d:%d:%d", &y, &m, &d, &h, &min, &sec);
-                Date dt(y, m, d, Time(h, min, sec));
-
-                if (type == "INCOME")
+                Connection& c = *static_cast<Connection*>(events[i].data.ptr);
+                bool open = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                if (open && (events[i].events & EPOLLIN))
                 {
-                    incomes.push_back(Income(category_or_source, amt, dt));
+                    char buffer[16384];
+                    ssize_t got;
+                    while ((got = recv(c.fd, buffer, sizeof(buffer), 0)) > 0) c.in.append(buffer, got);
+                    if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) c.closing = true;
+                    process(c);
                 }
-                else if (type == "EXPENSE")
+                if (!flushOutput(c) || !open)
                 {
-                    expenses.push_back(Expense(category_or_source, amt, dt));
+                    int fd = c.fd;
+                    close(fd);
+                    connections.erase(fd);
                 }
             }
         }
-        file.close();
-        cout << "Loaded from " << filename << " (" << incomes.size() << " incomes, "
-             << expenses.size() << " expenses, " << budgets.size() << " budgets)\n";
+        for (const auto& c : connections) close(c.first);
+        close(ep);
     }
-};
-
 
-int getValidatedInt(const string& prompt, int min = INT_MIN, int max = INT_MAX)
-{
-    string input;
-    int value;
-    while (true)
+    bool listenOn(const string& address)
     {
-        cout << prompt;
-        getline(cin, input);
-        if (isValidInt(input))
+        if (isValidInt(address))
         {
-            value = stoi(input);
-            if (value >= min && value <= max)
-                return value;
-            else
-                cout << "Please enter a number between " << min << " and " << max << ".\n";
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int yes = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(stoi(address)));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return false;
         }
         else
         {
-            cout << "Invalid input. Please enter a valid integer.\n";
+            sockaddr_un addr{};
+            if (address.size() >= sizeof(addr.sun_path)) return false;
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            addr.sun_family = AF_UNIX;
+            address.copy(addr.sun_path, address.size());
+            // Only a stale socket from an earlier run may be replaced; any
+            // other file at the path (the ledger, say) is left alone.
+            struct stat existing;
+            if (lstat(address.c_str(), &existing) == 0)
+            {
+                if (!S_ISSOCK(existing.st_mode))
+                {
+                    errno = ENOTSOCK;
+                    return false;
+                }
+                unlink(address.c_str());
+            }
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return false;
         }
+        return listen(listenFd, SOMAXCONN) == 0;
+    }
+
+public:
+    explicit LedgerServer(FinanceTracker& t) : tracker(t)
+    {
     }
-}
 
+    int run(const string& address, unsigned threads)
+    {
+        // Queries run against const views, so everything lazy is loaded up front.
+        tracker.ensureAllLoaded();
+        tracker.refreshStats();
+        if (!listenOn(address))
+        {
+            cout << "Error: Could not listen on " << address << " (" << strerror(errno) << ")!\n";
+            return 1;
+        }
+        stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        cout << "Serving on " << address << " with " << threads << " event loop(s); Ctrl+C to stop.\n" << flush;
 
-double getValidatedDouble(const string& prompt, double min = 0)
+        vector<thread> loops;
+        for (unsigned i = 0; i < threads; ++i) loops.emplace_back(&LedgerServer::loop, this, i == 0);
+        for (auto& t : loops) t.join();
+        close(listenFd);
+        close(stopFd);
+        if (!isValidInt(address)) unlink(address.c_str());
+        cout << "\nServed " << requests << " requests.\n";
+        return 0;
+    }
+};
+
+int LedgerServer::stopFd = -1;
+
+// Opens `connections` clients that each keep `pipeline` requests in flight
+// for `seconds`, then reports throughput and latency percentiles.
+int runLoadGenerator(const string& address, int connections, int seconds, int pipeline)
 {
-    string input;
-    double value;
-    while (true)
+    typedef chrono::steady_clock Clock;
+    static const char* mix[] = {"BALANCE", "TOTALS", "SPENT food", "BUDGETS", "STATS food", "PING"};
+    vector<vector<double>> latencies(connections);
+    atomic<unsigned long long> errors{0};
+    atomic<bool> failed{false};
+    Clock::time_point deadline = Clock::now() + chrono::seconds(seconds);
+
+    auto client = [&](int id)
     {
-        cout << prompt;
-        getline(cin, input);
-        if (isValidDouble(input))
+        int fd;
+        if (isValidInt(address))
         {
-            value = stod(input);
-            if (value >= min)
-                return value;
-            else
-                cout << "Please enter a number >= " << min << ".\n";
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(stoi(address)));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) failed = true;
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
         }
         else
         {
-            cout << "Invalid input. Please enter a valid number.\n";
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            address.copy(addr.sun_path, min(address.size(), sizeof(addr.sun_path) - 1));
+            if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) failed = true;
+        }
+        if (failed)
+        {
+            close(fd);
+            return;
+        }
+
+        string batch;
+        for (int k = 0; k < pipeline; ++k) batch += string(mix[(id + k) % 6]) + "\n";
+        string pending;
+        char buffer[16384];
+        while (Clock::now() < deadline)
+        {
+            Clock::time_point sent = Clock::now();
+            if (send(fd, batch.data(), batch.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(batch.size())) break;
+            int answered = 0;
+            while (answered < pipeline)
+            {
+                ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+                if (got <= 0) break;
+                pending.append(buffer, got);
+                size_t nl;
+                while ((nl = pending.find('\n')) != string::npos)
+                {
+                    if (pending.compare(0, 2, "OK") != 0) errors++;
+                    pending.erase(0, nl + 1);
+                    latencies[id].push_back(chrono::duration<double>(Clock::now() - sent).count());
+                    answered++;
+                }
+            }
+            if (answered < pipeline) break;
         }
+        close(fd);
+    };
+
+    Clock::time_point start = Clock::now();
+    vector<thread> clients;
+    for (int i = 0; i < connections; ++i) clients.emplace_back(client, i);
+    for (auto& t : clients) t.join();
+    double elapsed = chrono::duration<double>(Clock::now() - start).count();
+    if (failed)
+    {
+        cout << "Error: Could not connect to " << address << "!\n";
+        return 1;
+    }
+
+    vector<double> all;
+    for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    if (all.empty())
+    {
+        cout << "Error: No responses from " << address << "!\n";
+        return 1;
     }
+    sort(all.begin(), all.end());
+    auto percentile = [&](double q) { return all[static_cast<size_t>(q * (all.size() - 1))] * 1e6; };
+    cout << fixed << setprecision(0);
+    cout << "Requests: " << all.size() << " over " << connections << " connection(s), pipeline depth " << pipeline << "\n";
+    cout << "Throughput: " << all.size() / elapsed << " requests/s\n" << setprecision(1);
+    cout << "Latency: p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max " << all.back() * 1e6 << " us\n";
+    cout << "Errors: " << errors << "\n";
+    return errors == 0 ? 0 : 1;
 }
+#endif
 
+vector<string> promptTags()
+{
+    string input;
+    cout << "Tags (comma separated, blank for none): ";
+    getline(cin, input);
+    return parseTagList(input);
+}
 
-string getValidatedString(const string& prompt)
+string promptCurrency()
 {
     string input;
-    while (true)
-    {
-        cout << prompt;
-        getline(cin, input);
-        if (!input.empty())
-            return input;
-        else
-            cout << "Input cannot be empty. Please try again.\n";
-    }
+    cout << "Currency code (blank for base currency): ";
+    getline(cin, input);
+    return input;
+}
+
+void promptSortedView(FinanceTracker& tracker, bool incomes)
+{
+    cout << "\nSort by:\n";
+    cout << "1. Amount\n";
+    cout << "2. Date\n";
+    cout << (incomes ? "3. Source\n" : "3. Category\n");
+    int keyChoice = getValidatedInt("Choice: ", 1, 3);
+    SortKey key = keyChoice == 1 ? SortKey::AMOUNT : (keyChoice == 2 ? SortKey::DATE : SortKey::LABEL);
+    cout << "1. Descending\n2. Ascending\n";
+    bool descending = getValidatedInt("Order: ", 1, 2) == 1;
+    size_t pageSize = static_cast<size_t>(getValidatedInt("Rows per page (top N): ", 1, 1000));
+    size_t page = static_cast<size_t>(getValidatedInt("Page (1 = top): ", 1)) - 1;
+
+    string expression;
+    char ch;
+    cout << "Narrow with a filter expression first? (y/n): ";
+    cin >> ch;
+    clearInputBuffer();
+    if (ch == 'y' || ch == 'Y') expression = getValidatedString("Filter: ");
+
+    if (incomes) tracker.viewIncomesSorted(key, descending, page, pageSize, expression);
+    else tracker.viewExpensesSorted(key, descending, page, pageSize, expression);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-    FinanceTracker tracker;
+    if (argc >= 3 && string(argv[1]) == "--bench")
+    {
+        size_t rows = (argc >= 4 && isValidInt(argv[3])) ? static_cast<size_t>(stoi(argv[3])) : 0;
+        return LedgerBenchmark::run(argv[2], rows);
+    }
+    if (argc >= 2 && (string(argv[1]) == "--serve" || string(argv[1]) == "--loadgen"))
+    {
+#ifdef __linux__
+        string address = argc >= 3 ? argv[2] : "finance.sock";
+        auto intArg = [&](int i, int fallback) { return (argc > i && isValidInt(argv[i])) ? max(1, stoi(argv[i])) : fallback; };
+        if (string(argv[1]) == "--loadgen") return runLoadGenerator(address, intArg(3, 8), intArg(4, 5), intArg(5, 16));
+        FinanceTracker tracker;
+        LedgerServer server(tracker);
+        return server.run(address, intArg(3, max(1u, thread::hardware_concurrency())));
+#else
+        cout << "Error: Server mode needs Linux (epoll)!\n";
+        return 1;
+#endif
+    }
+
+    bool mappedMode = argc >= 3 && string(argv[1]) == "--mapped";
+    FinanceTracker tracker(mappedMode ? "" : "finance_data.csv");
+    if (mappedMode && !tracker.attachMapped(argv[2])) return 1;
     int choice;
 
     do
     {
+        tracker.tick();
         cout << "\n=== Personal Finance Tracker ===\n";
         cout << "1. Manage Incomes\n";
         cout << "2. Manage Expenses\n";
@@ -892,21 +8575,33 @@ int main()
         cout << "5. Show Summary\n";
         cout << "6. Show Category Details\n";
         cout << "7. Show Transactions in Time Period\n";
+        cout << "8. Show Balance Timeline\n";
+        cout << "9. Search With Filter\n";
+        cout << "10. Archive Old Years\n";
+        cout << "11. Recurring Transactions\n";
+        cout << "12. Import or Reconcile a Statement\n";
+        cout << "13. Category Statistics\n";
+        cout << "14. Undo / Redo\n";
+        cout << "15. Currencies\n";
+        cout << "16. Cash-Flow Forecast\n";
+        cout << "17. Export for Analytics\n";
         cout << "0. Exit & Save\n";
 
-        choice = getValidatedInt("Choice: ", 0, 7);
+        choice = getValidatedInt("Choice: ", 0, 17);
 
         if (choice == 1)
         {
             int subChoice;
             cout << "\nIncome Management:\n";
-            cout << "1. Add Income\n2. View Incomes\n3. Update Income\n4. Delete Income\n0. Back\n";
-            subChoice = getValidatedInt("Choice: ", 0, 4);
+            cout << "1. Add Income\n2. View Incomes\n3. Update Income\n4. Delete Income\n5. View Sorted / Top N\n6. Set Tags\n0. Back\n";
+            subChoice = getValidatedInt("Choice: ", 0, 6);
 
             if (subChoice == 1)
             {
                 double amt = getValidatedDouble("Amount: ", 0);
                 string src = getValidatedString("Source: ");
+                vector<string> tags = promptTags();
+                string currency = promptCurrency();
 
                 char ch;
                 cout << "Do you want to enter date and time or add transaction with current date? (y/n): ";
@@ -921,11 +8616,11 @@ int main()
                     int h = getValidatedInt("Hour (0-23): ", 0, 23);
                     int min = getValidatedInt("Minute (0-59): ", 0, 59);
                     int sec = getValidatedInt("Second (0-59): ", 0, 59);
-                    tracker.addIncome(amt, Date(y, m, d, Time(h, min, sec)), src);
+                    tracker.addIncome(amt, Date(y, m, d, Time(h, min, sec)), src, tags, currency);
                 }
                 else
                 {
-                    tracker.addIncome(amt, getCurrentDate(), src);
+                    tracker.addIncome(amt, getCurrentDate(), src, tags, currency);
                 }
             }
             else if (subChoice == 2)
@@ -979,18 +8674,30 @@ int main()
                 int index = getValidatedInt("Index: ", 0);
                 tracker.deleteIncome(index);
             }
+            else if (subChoice == 5)
+            {
+                promptSortedView(tracker, true);
+            }
+            else if (subChoice == 6)
+            {
+                tracker.viewIncomes();
+                int index = getValidatedInt("Index: ", 0);
+                tracker.setIncomeTags(index, promptTags());
+            }
         }
         else if (choice == 2)
         {
             int subChoice;
             cout << "\nExpense Management:\n";
-            cout << "1. Add Expense\n2. View Expenses\n3. Update Expense\n4. Delete Expense\n0. Back\n";
-            subChoice = getValidatedInt("Choice: ", 0, 4);
+            cout << "1. Add Expense\n2. View Expenses\n3. Update Expense\n4. Delete Expense\n5. View Sorted / Top N\n6. Set Tags\n0. Back\n";
+            subChoice = getValidatedInt("Choice: ", 0, 6);
 
             if (subChoice == 1)
             {
                 double amt = getValidatedDouble("Amount: ", 0);
-                string cat = getValidatedString("Category: ");
+                string cat = getValidatedString("Category (e.g. food/groceries): ");
+                vector<string> tags = promptTags();
+                string currency = promptCurrency();
                   char ch;
                 cout << "Do you want to enter date and time or add transaction with current date? (y/n): ";
                 cin >> ch;
@@ -1004,11 +8711,11 @@ int main()
                     int h = getValidatedInt("Hour (0-23): ", 0, 23);
                     int min = getValidatedInt("Minute (0-59): ", 0, 59);
                     int sec = getValidatedInt("Second (0-59): ", 0, 59);
-                    tracker.addExpense(amt, Date(y, m, d, Time(h, min, sec)), cat);
+                    tracker.addExpense(amt, Date(y, m, d, Time(h, min, sec)), cat, tags, currency);
                 }
                 else
                 {
-                    tracker.addExpense(amt, getCurrentDate(), cat);
+                    tracker.addExpense(amt, getCurrentDate(), cat, tags, currency);
                 }
 
             }
@@ -1061,12 +8768,44 @@ int main()
                 int index = getValidatedInt("Index: ", 0);
                 tracker.deleteExpense(index);
             }
+            else if (subChoice == 5)
+            {
+                promptSortedView(tracker, false);
+            }
+            else if (subChoice == 6)
+            {
+                tracker.viewExpenses();
+                int index = getValidatedInt("Index: ", 0);
+                tracker.setExpenseTags(index, promptTags());
+            }
         }
         else if (choice == 3)
         {
-            string cat = getValidatedString("Category: ");
+            string cat = getValidatedString("Category (a parent such as food covers food/...): ");
             double limit = getValidatedDouble("Limit: ", 0);
-            tracker.setBudget(cat, limit);
+            cout << "\nBudget period:\n";
+            cout << "1. All time\n";
+            cout << "2. Monthly (calendar month)\n";
+            cout << "3. Weekly (Monday to Sunday)\n";
+            cout << "4. Rolling number of days\n";
+            int periodChoice = getValidatedInt("Choice: ", 1, 4);
+            if (periodChoice == 2)
+            {
+                tracker.setBudget(cat, limit, BudgetPeriod::MONTHLY);
+            }
+            else if (periodChoice == 3)
+            {
+                tracker.setBudget(cat, limit, BudgetPeriod::WEEKLY);
+            }
+            else if (periodChoice == 4)
+            {
+                int days = getValidatedInt("Days in window (1-3650): ", 1, 3650);
+                tracker.setBudget(cat, limit, BudgetPeriod::ROLLING_DAYS, days);
+            }
+            else
+            {
+                tracker.setBudget(cat, limit);
+            }
         }
         else if (choice == 4)
         {
@@ -1096,6 +8835,202 @@ int main()
             tracker.generateReportForPeriod(Date(sy, sm, sd, Time(0, 0, 0)),
                                             Date(ey, em, ed, Time(23, 59, 59)));
         }
+        else if (choice == 8)
+        {
+            cout << "\nStart Date:\n";
+            int sy = getValidatedInt("Year (1900-9999): ", 1900, 9999);
+            int sm = getValidatedInt("Month (1-12): ", 1, 12);
+            int sd = getValidatedInt("Day (1-31): ", 1, 31);
+
+            cout << "\nEnd Date:\n";
+            int ey = getValidatedInt("Year (1900-9999): ", 1900, 9999);
+            int em = getValidatedInt("Month (1-12): ", 1, 12);
+            int ed = getValidatedInt("Day (1-31): ", 1, 31);
+
+            int step = getValidatedInt("Days between points (1-366): ", 1, 366);
+            tracker.generateBalanceTimeline(Date(sy, sm, sd, Time(0, 0, 0)),
+                                            Date(ey, em, ed, Time(23, 59, 59)), step);
+        }
+        else if (choice == 9)
+        {
+            cout << "\nSearch:\n";
+            cout << "1. Filter expression\n2. Tag query\n3. List tags\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 3);
+            if (subChoice == 1 || subChoice == 2)
+            {
+                if (subChoice == 1)
+                {
+                    cout << "\nFields: amount, category, source, date, type (income/expense)\n";
+                    cout << "Example: expense AND category IN (food, rent) AND amount >= 50 AND date >= 2026-01-01\n";
+                }
+                else cout << "\nExample: trip-2026 AND (reimbursable OR tax-deductible) AND NOT personal\n";
+                string expression = getValidatedString(subChoice == 1 ? "Filter: " : "Tags: ");
+                char ch;
+                cout << "List matching transactions? (y/n): ";
+                cin >> ch;
+                clearInputBuffer();
+                if (subChoice == 1) tracker.generateFilteredReport(expression, ch == 'y' || ch == 'Y');
+                else tracker.generateTagReport(expression, ch == 'y' || ch == 'Y');
+            }
+            else if (subChoice == 3)
+            {
+                tracker.viewTags();
+            }
+        }
+        else if (choice == 10)
+        {
+            cout << "\nArchive:\n";
+            cout << "1. Archive years before...\n2. Show storage report\n3. Export fixed-width ledger (for --mapped)\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 3);
+            if (subChoice == 1)
+            {
+                int year = getValidatedInt("Archive everything before year (1901-9999): ", 1901, 9999);
+                tracker.archiveYearsBefore(year);
+            }
+            else if (subChoice == 2)
+            {
+                tracker.generateStorageReport();
+            }
+            else if (subChoice == 3)
+            {
+                tracker.exportFixedWidth(getValidatedString("File to write: "));
+            }
+        }
+        else if (choice == 11)
+        {
+            cout << "\nRecurring Transactions:\n";
+            cout << "1. Add Recurring Income\n2. Add Recurring Expense\n3. View Recurring\n4. Delete Recurring\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 4);
+            if (subChoice == 1 || subChoice == 2)
+            {
+                bool isIncome = subChoice == 1;
+                string label = getValidatedString(isIncome ? "Source: " : "Category: ");
+                double amt = getValidatedDouble("Amount: ", 0);
+                cout << "Repeat: 1. Daily  2. Weekly  3. Monthly  4. Yearly\n";
+                int cadenceChoice = getValidatedInt("Choice: ", 1, 4);
+                int interval = getValidatedInt("Every how many (1-365): ", 1, 365);
+
+                cout << "\nFirst Date:\n";
+                int sy = getValidatedInt("Year (1900-9999): ", 1900, 9999);
+                int sm = getValidatedInt("Month (1-12): ", 1, 12);
+                int sd = getValidatedInt("Day (1-31): ", 1, 31);
+                Date end(9999, 12, 31, Time(23, 59, 59));
+                char ch;
+                cout << "Set an end date? (y/n): ";
+                cin >> ch;
+                clearInputBuffer();
+                if (ch == 'y' || ch == 'Y')
+                {
+                    int ey = getValidatedInt("Year (1900-9999): ", 1900, 9999);
+                    int em = getValidatedInt("Month (1-12): ", 1, 12);
+                    int ed = getValidatedInt("Day (1-31): ", 1, 31);
+                    end = Date(ey, em, ed, Time(23, 59, 59));
+                }
+                tracker.addRecurringRule(isIncome, label, amt, static_cast<Cadence>(cadenceChoice - 1), interval,
+                                         Date(sy, sm, sd, Time(0, 0, 0)), end);
+            }
+            else if (subChoice == 3)
+            {
+                tracker.viewRecurringRules();
+            }
+            else if (subChoice == 4)
+            {
+                tracker.viewRecurringRules();
+                int idx = getValidatedInt("Index to delete: ");
+                tracker.deleteRecurringRule(idx);
+            }
+        }
+        else if (choice == 12)
+        {
+            cout << "\nStatements:\n";
+            cout << "1. Import transactions\n2. Reconcile with a statement\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 2);
+            if (subChoice == 1)
+            {
+                string filename = getValidatedString("File to import: ");
+                cout << "Rows already in the ledger:\n";
+                cout << "1. Skip them\n2. Import and flag them\n3. Merge (match each ledger row once)\n";
+                int policyChoice = getValidatedInt("Choice: ", 1, 3);
+                tracker.importFile(filename, static_cast<DuplicatePolicy>(policyChoice - 1));
+            }
+            else if (subChoice == 2)
+            {
+                cout << "Lines may be INCOME/EXPENSE records or date,signed amount,description\n";
+                string filename = getValidatedString("Statement file: ");
+                int days = getValidatedInt("Date tolerance in days (0-31): ", 0, 31);
+                double cents = getValidatedDouble("Amount tolerance: ", 0);
+                tracker.reconcileStatement(filename, days, cents);
+            }
+        }
+        else if (choice == 13)
+        {
+            tracker.generateCategoryStats();
+        }
+        else if (choice == 14)
+        {
+            cout << "\nHistory:\n";
+            cout << "1. Undo\n2. Redo\n3. Show history\n4. Set history depth (not undoable)\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 4);
+            if (subChoice == 1) tracker.undo();
+            else if (subChoice == 2) tracker.redo();
+            else if (subChoice == 3) tracker.viewHistory();
+            else if (subChoice == 4) tracker.setHistoryDepth(getValidatedInt("Steps to keep (0-10000): ", 0, 10000));
+        }
+        else if (choice == 15)
+        {
+            cout << "\nCurrencies:\n";
+            cout << "1. Load exchange rates\n2. Set reporting currency\n3. Set base currency\n4. Show rates\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 4);
+            if (subChoice == 1) tracker.importRates(getValidatedString("Rates file (YYYY-MM-DD,CODE,rate per line): "));
+            else if (subChoice == 2)
+            {
+                string code;
+                cout << "Reporting currency (blank for base currency): ";
+                getline(cin, code);
+                tracker.setReportCurrency(code);
+            }
+            else if (subChoice == 3) tracker.setBaseCurrency(getValidatedString("Base currency code: "));
+            else if (subChoice == 4) tracker.viewRates();
+        }
+        else if (choice == 16)
+        {
+            tracker.generateForecast(getValidatedInt("Horizon in days (1-3650): ", 1, 3650));
+        }
+        else if (choice == 17)
+        {
+            cout << "\nExport for Analytics:\n";
+            cout << "1. JSON Lines\n2. Columnar (FTCOL1)\n0. Back\n";
+            int subChoice = getValidatedInt("Choice: ", 0, 2);
+            if (subChoice != 0)
+            {
+                string filename = getValidatedString("File to write: ");
+                Date start(1900, 1, 1, Time(0, 0, 0));
+                Date end(9999, 12, 31, Time(23, 59, 59));
+                char ch;
+                cout << "Limit to a date range? (y/n): ";
+                cin >> ch;
+                clearInputBuffer();
+                if (ch == 'y' || ch == 'Y')
+                {
+                    cout << "\nStart Date:\n";
+                    int sy = getValidatedInt("Year (1900-9999): ", 1900, 9999);
+                    int sm = getValidatedInt("Month (1-12): ", 1, 12);
+                    int sd = getValidatedInt("Day (1-31): ", 1, 31);
+
+                    cout << "\nEnd Date:\n";
+                    int ey = getValidatedInt("Year (1900-9999): ", 1900, 9999);
+                    int em = getValidatedInt("Month (1-12): ", 1, 12);
+                    int ed = getValidatedInt("Day (1-31): ", 1, 31);
+                    start = Date(sy, sm, sd, Time(0, 0, 0));
+                    end = Date(ey, em, ed, Time(23, 59, 59));
+                }
+                string category;
+                cout << "Expense category (blank for all transactions): ";
+                getline(cin, category);
+                tracker.exportTransactions(filename, subChoice == 1 ? ExportFormat::JSON_LINES : ExportFormat::COLUMNAR,
+                                           start, end, category);
+            }
+        }
     }
     while (choice != 0);
 